@@ -0,0 +1,177 @@
+#include "bench-client.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#define BENCH_CLIENT_WINDOWS 16
+
+struct bench_client_window {
+	struct wl_surface *surface;
+	struct wl_buffer *buffer;
+	uint32_t *data;
+	size_t size;
+	int width, height;
+	bool opaque;
+	/* Shifts the pattern, so that every commit changes the pixels */
+	uint32_t frame;
+};
+
+struct bench_client {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct bench_client_window windows[BENCH_CLIENT_WINDOWS];
+	int num_windows;
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
+								   const char *interface, uint32_t version) {
+	struct bench_client *client = data;
+	if (strcmp(interface, wl_compositor_interface.name) == 0 && version >= 4) {
+		client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		client->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	}
+}
+
+static void registry_handle_global_remove(void *data, struct wl_registry *registry,
+										  uint32_t name) {
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+/* Connects to the compositor of the bench over one end of a socket pair. The globals arrive
+   once the compositor handled the request for them */
+struct bench_client *bench_client_connect(int fd) {
+	struct bench_client *client = calloc(1, sizeof(struct bench_client));
+	if (client == NULL) {
+		close(fd);
+		return NULL;
+	}
+	client->display = wl_display_connect_to_fd(fd);
+	if (client->display == NULL) {
+		free(client);
+		return NULL;
+	}
+	client->registry = wl_display_get_registry(client->display);
+	wl_registry_add_listener(client->registry, &registry_listener, client);
+	return client;
+}
+
+void bench_client_disconnect(struct bench_client *client) {
+	for (int i = 0; i < client->num_windows; i++) {
+		struct bench_client_window *window = &client->windows[i];
+		wl_surface_destroy(window->surface);
+		wl_buffer_destroy(window->buffer);
+		munmap(window->data, window->size);
+	}
+	if (client->compositor != NULL) {
+		wl_compositor_destroy(client->compositor);
+	}
+	if (client->shm != NULL) {
+		wl_shm_destroy(client->shm);
+	}
+	wl_registry_destroy(client->registry);
+	wl_display_disconnect(client->display);
+	free(client);
+}
+
+bool bench_client_ready(struct bench_client *client) {
+	return client->compositor != NULL && client->shm != NULL;
+}
+
+/* Sends the requests of the client and handles the events which arrived, without waiting
+   for more. The compositor runs on the same thread, so blocking would never return */
+bool bench_client_dispatch(struct bench_client *client) {
+	struct wl_display *display = client->display;
+	while (wl_display_prepare_read(display) != 0) {
+		if (wl_display_dispatch_pending(display) < 0) {
+			return false;
+		}
+	}
+	struct pollfd pollfd = {.fd = wl_display_get_fd(display), .events = POLLIN};
+	if (poll(&pollfd, 1, 0) > 0) {
+		if (wl_display_read_events(display) < 0) {
+			return false;
+		}
+	} else {
+		wl_display_cancel_read(display);
+	}
+	return wl_display_dispatch_pending(display) >= 0 && wl_display_flush(display) >= 0;
+}
+
+/* Creates a file for a buffer which is not linked anywhere */
+static int create_shm_file(size_t size) {
+	static int serial;
+	char name[64];
+	snprintf(name, sizeof(name), "/kwm-bench-%d-%d", getpid(), serial++);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return -1;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Creates a window and commits all of it. Every other window is translucent in the bench */
+bool bench_client_add_window(struct bench_client *client, int width, int height, bool opaque) {
+	if (client->num_windows == BENCH_CLIENT_WINDOWS) {
+		return false;
+	}
+	struct bench_client_window *window = &client->windows[client->num_windows];
+	int stride = width * 4;
+	window->size = (size_t)stride * height;
+	int fd = create_shm_file(window->size);
+	if (fd < 0) {
+		return false;
+	}
+	window->data = mmap(NULL, window->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (window->data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	struct wl_shm_pool *pool = wl_shm_create_pool(client->shm, fd, window->size);
+	window->buffer = wl_shm_pool_create_buffer(
+		pool, 0, width, height, stride, opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	window->surface = wl_compositor_create_surface(client->compositor);
+	window->width = width, window->height = height;
+	window->opaque = opaque;
+	bench_client_draw(client, client->num_windows++, 0, 0, width, height);
+	return true;
+}
+
+/* Redraws part of a window and commits it with that damage. The buffer is committed again
+   right away: the compositor copies or uploads it within the commit, before the client gets
+   to draw the next frame */
+void bench_client_draw(struct bench_client *client, int index, int x, int y, int width,
+					   int height) {
+	struct bench_client_window *window = &client->windows[index];
+	uint32_t frame = window->frame++;
+	for (int j = y; j < y + height; j++) {
+		for (int i = x; i < x + width; i++) {
+			uint32_t shade = ((i ^ j) + frame) & 0x7f;
+			window->data[j * window->width + i] =
+				window->opaque ? 0xff000000 | shade << 16 | shade << 8 : 0x80000000 | shade;
+		}
+	}
+	wl_surface_attach(window->surface, window->buffer, 0, 0);
+	wl_surface_damage_buffer(window->surface, x, y, width, height);
+	wl_surface_commit(window->surface);
+}
@@ -0,0 +1,20 @@
+#ifndef KWM_BENCH_CLIENT_H
+#define KWM_BENCH_CLIENT_H
+
+#include <stdbool.h>
+
+/* The client side of the bench. It lives in its own file since the headers of the client and
+   the server library cannot be mixed, and talks to the compositor of the bench over a socket
+   within the same process. Windows are surfaces without a role, each with one shared memory
+   buffer which is drawn to and committed again */
+struct bench_client;
+
+struct bench_client *bench_client_connect(int fd);
+void bench_client_disconnect(struct bench_client *client);
+bool bench_client_ready(struct bench_client *client);
+bool bench_client_dispatch(struct bench_client *client);
+bool bench_client_add_window(struct bench_client *client, int width, int height, bool opaque);
+void bench_client_draw(struct bench_client *client, int window, int x, int y, int width,
+					   int height);
+
+#endif
@@ -0,0 +1,312 @@
+/* Measures the scene of kwm on a headless output, drawn by the renderer of the backend and by
+   the software renderer. A client in the same process shows bordered windows, which are
+   either opaque or translucent, and commits to them before every frame. Handling those
+   commits, the copies of the buffers and the texture uploads, is part of the frame. Both
+   renderers are measured with all windows redrawn over the whole output, and with a small
+   update of the top window.
+
+   usage: bench [frames] */
+#include "bench-client.h"
+#include "server.h"
+#include "kwm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/util/log.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+/* Refresh rate of the output in mHz. Waiting for the output is not measured, a fast one only
+   shortens the run */
+#define BENCH_REFRESH 1000000
+#define BENCH_WINDOWS 8
+#define BENCH_WINDOW_WIDTH 800
+#define BENCH_WINDOW_HEIGHT 600
+#define BENCH_BORDER 2
+
+/* The renderer draws from the textures of wlroots, as kwm does without a texture budget. The
+   software renderer is switched on in the scene */
+const int software_rendering = 0;
+const int texture_budget = 0;
+
+struct bench;
+
+struct bench_window {
+	struct bench *bench;
+	struct wlr_surface *surface;
+	struct kwm_scene_node *tree;
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+struct bench {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_output_layout *layout;
+	struct kwm_scene *scene;
+	struct kwm_output output;
+	struct bench_client *client;
+
+	struct bench_window windows[BENCH_WINDOWS];
+	int num_windows;
+	/* Commits the scene handled, of all windows */
+	int commits;
+
+	struct wl_listener new_surface;
+};
+
+static const float border_color[4] = {1.0, 0.3, 0.3, 1.0};
+
+/* The only client of the bench has no frame-rate cap */
+bool client_frame_done_allowed(struct kwm_server *server, struct wlr_surface *surface,
+							   struct timespec *when) {
+	return true;
+}
+
+/* The listener is added after the one of the scene, so the scene is done with the commit */
+static void handle_window_commit(struct wl_listener *listener, void *data) {
+	struct bench_window *window = wl_container_of(listener, window, commit);
+	window->bench->commits++;
+}
+
+static void handle_window_destroy(struct wl_listener *listener, void *data) {
+	struct bench_window *window = wl_container_of(listener, window, destroy);
+	wl_list_remove(&window->commit.link);
+	wl_list_remove(&window->destroy.link);
+	window->surface = NULL;
+}
+
+/* Places the surfaces of the client the way kwm places views, cascaded in a tree along with
+   their border */
+static void handle_compositor_new_surface(struct wl_listener *listener, void *data) {
+	struct bench *bench = wl_container_of(listener, bench, new_surface);
+	struct wlr_surface *surface = data;
+	if (bench->num_windows == BENCH_WINDOWS) {
+		return;
+	}
+	int i = bench->num_windows++;
+	struct bench_window *window = &bench->windows[i];
+	window->bench = bench;
+	window->surface = surface;
+	window->tree = scene_tree_create(bench->output.scene_tree);
+	scene_node_set_position(window->tree, 100 + i * 80, 60 + i * 50);
+
+	int width = BENCH_WINDOW_WIDTH, height = BENCH_WINDOW_HEIGHT;
+	struct wlr_box borders[4] = {
+		{-BENCH_BORDER, -BENCH_BORDER, width + BENCH_BORDER * 2, BENCH_BORDER},
+		{-BENCH_BORDER, height, width + BENCH_BORDER * 2, BENCH_BORDER},
+		{-BENCH_BORDER, 0, BENCH_BORDER, height},
+		{width, 0, BENCH_BORDER, height},
+	};
+	for (int j = 0; j < 4; j++) {
+		struct kwm_scene_rect *rect = scene_rect_create(window->tree, borders[j].width,
+														borders[j].height, border_color);
+		scene_node_set_position(&rect->node, borders[j].x, borders[j].y);
+	}
+	scene_surface_create(window->tree, surface);
+
+	window->commit.notify = handle_window_commit;
+	wl_signal_add(&surface->events.commit, &window->commit);
+	window->destroy.notify = handle_window_destroy;
+	wl_signal_add(&surface->events.destroy, &window->destroy);
+}
+
+/* Lets the client send its requests and the compositor handle them. The compositor waits
+   for the client or for the next frame of the output */
+static bool bench_dispatch(struct bench *bench) {
+	if (!bench_client_dispatch(bench->client) || wl_event_loop_dispatch(bench->loop, -1) < 0) {
+		return false;
+	}
+	wl_display_flush_clients(bench->display);
+	return true;
+}
+
+static bool bench_wait_commits(struct bench *bench, int commits) {
+	while (bench->commits < commits) {
+		if (!bench_dispatch(bench)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool bench_wait_frame(struct bench *bench) {
+	while (bench->output.wlr_output->frame_pending) {
+		if (!bench_dispatch(bench)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Renders the damage of the output the way kwm does. Reading back a pixel waits until the
+   renderer is done with the frame */
+static bool bench_render(struct bench *bench) {
+	struct kwm_output *output = &bench->output;
+	bool needs_frame;
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	if (!wlr_output_damage_attach_render(output->damage, &needs_frame, &damage)) {
+		pixman_region32_fini(&damage);
+		return false;
+	}
+	scene_render_output(bench->scene, output, &damage);
+	uint32_t pixel, flags = 0;
+	wlr_renderer_read_pixels(bench->renderer, WL_SHM_FORMAT_XRGB8888, &flags, 4, 1, 1, 0, 0, 0,
+							 0, &pixel);
+	pixman_region32_fini(&damage);
+	return wlr_output_commit(output->wlr_output);
+}
+
+/* Returns the average time of a frame in microseconds. It starts once the client drew its
+   windows and ends once the frame is rendered, so it covers the commits of the frame */
+static double bench_run(struct bench *bench, int frames, bool full) {
+	double total = 0;
+	for (int i = 0; i < frames; i++) {
+		if (!bench_wait_frame(bench)) {
+			return -1;
+		}
+		int commits = bench->commits;
+		if (full) {
+			for (int j = 0; j < bench->num_windows; j++) {
+				bench_client_draw(bench->client, j, 0, 0, BENCH_WINDOW_WIDTH,
+								  BENCH_WINDOW_HEIGHT);
+			}
+			commits += bench->num_windows;
+			wlr_output_damage_add_whole(bench->output.damage);
+		} else {
+			bench_client_draw(bench->client, bench->num_windows - 1, 40, 40, 100, 100);
+			commits++;
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (!bench_wait_commits(bench, commits) || !bench_render(bench)) {
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		total += (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+	}
+	return total / frames;
+}
+
+/* Sets up an output showing the windows of the client, which are mapped once this returns */
+static bool bench_init(struct bench *bench) {
+	bench->display = wl_display_create();
+	bench->loop = wl_display_get_event_loop(bench->display);
+	bench->backend = wlr_headless_backend_create(bench->display, NULL);
+	if (bench->backend == NULL) {
+		fprintf(stderr, "Failed to create the headless backend\n");
+		return false;
+	}
+	bench->renderer = wlr_backend_get_renderer(bench->backend);
+	wlr_renderer_init_wl_display(bench->renderer, bench->display);
+	struct wlr_compositor *compositor = wlr_compositor_create(bench->display, bench->renderer);
+	bench->new_surface.notify = handle_compositor_new_surface;
+	wl_signal_add(&compositor->events.new_surface, &bench->new_surface);
+
+	struct wlr_output *wlr_output =
+		wlr_headless_add_output(bench->backend, BENCH_WIDTH, BENCH_HEIGHT);
+	if (wlr_output == NULL || !wlr_backend_start(bench->backend)) {
+		fprintf(stderr, "Failed to start the headless backend\n");
+		return false;
+	}
+	wlr_output_set_custom_mode(wlr_output, BENCH_WIDTH, BENCH_HEIGHT, BENCH_REFRESH);
+	wlr_output_enable(wlr_output, true);
+	if (!wlr_output_commit(wlr_output)) {
+		fprintf(stderr, "Failed to enable the headless output\n");
+		return false;
+	}
+	bench->layout = wlr_output_layout_create();
+	wlr_output_layout_add(bench->layout, wlr_output, 0, 0);
+
+	bench->scene = scene_create(bench->layout, bench->renderer);
+	bench->output.wlr_output = wlr_output;
+	bench->output.damage = wlr_output_damage_create(wlr_output);
+	bench->output.tags = 1;
+	bench->output.scene_tree = scene_output_create(bench->scene, &bench->output);
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0 ||
+		wl_client_create(bench->display, fds[0]) == NULL ||
+		(bench->client = bench_client_connect(fds[1])) == NULL) {
+		fprintf(stderr, "Failed to connect the client\n");
+		return false;
+	}
+	while (!bench_client_ready(bench->client)) {
+		if (!bench_dispatch(bench)) {
+			return false;
+		}
+	}
+	for (int i = 0; i < BENCH_WINDOWS; i++) {
+		if (!bench_client_add_window(bench->client, BENCH_WINDOW_WIDTH, BENCH_WINDOW_HEIGHT,
+									 i % 2 == 0)) {
+			fprintf(stderr, "Failed to create the windows\n");
+			return false;
+		}
+	}
+	return bench_wait_commits(bench, BENCH_WINDOWS) && bench->num_windows == BENCH_WINDOWS;
+}
+
+static void bench_finish(struct bench *bench) {
+	if (bench->client != NULL) {
+		bench_client_disconnect(bench->client);
+	}
+	wl_display_destroy_clients(bench->display);
+	raster_finish(&bench->output.raster);
+	if (bench->scene != NULL) {
+		scene_destroy(bench->scene);
+	}
+	if (bench->backend != NULL) {
+		wlr_backend_destroy(bench->backend);
+	}
+	if (bench->layout != NULL) {
+		wlr_output_layout_destroy(bench->layout);
+	}
+	wl_display_destroy(bench->display);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 200;
+	if (frames <= 0) {
+		fprintf(stderr, "usage: bench [frames]\n");
+		return EXIT_FAILURE;
+	}
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct bench bench = {0};
+	if (!bench_init(&bench)) {
+		bench_finish(&bench);
+		return EXIT_FAILURE;
+	}
+
+	/* The software renderer goes second, its copies of the buffers are made by the commits
+	   of its first frame */
+	double results[2][2];
+	for (int software = 0; software < 2; software++) {
+		bench.scene->software_rendering = software;
+		results[software][0] = bench_run(&bench, frames, true);
+		results[software][1] = bench_run(&bench, frames, false);
+	}
+
+	printf("%d frames at %dx%d, %d windows\n", frames, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WINDOWS);
+	const char *names[2] = {"full", "update"};
+	for (int i = 0; i < 2; i++) {
+		double renderer = results[0][i], software = results[1][i];
+		printf("%-8s renderer %9.1f us  software %9.1f us  %5.2fx\n", names[i], renderer,
+			   software, software > 0 ? renderer / software : 0);
+	}
+	bench_finish(&bench);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,268 @@
+#include "client.h"
+#include "server.h"
+#include "kwm.h"
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+
+/* Returns the time elapsed between two timestamps in nanoseconds */
+static int64_t timespec_diff_ns(struct timespec *start, struct timespec *end) {
+	return (int64_t)(end->tv_sec - start->tv_sec) * 1000000000 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Looks up the accounting of a client, creating it on first use. The destroy listener
+   doubles as the link between the wl_client and its kwm_client */
+static struct kwm_client *client_get(struct kwm_server *server, struct wl_client *wl_client) {
+	struct wl_listener *listener =
+		wl_client_get_destroy_listener(wl_client, handle_client_destroy);
+	if (listener != NULL) {
+		struct kwm_client *client = wl_container_of(listener, client, destroy);
+		return client;
+	}
+
+	struct kwm_client *client = calloc(1, sizeof(struct kwm_client));
+	if (client == NULL) {
+		return NULL;
+	}
+	client->server = server;
+	client->wl_client = wl_client;
+	wl_client_get_credentials(wl_client, &client->pid, NULL, NULL);
+	wl_list_init(&client->surfaces);
+	clock_now(&server->clock, &client->window_start);
+
+	client->destroy.notify = handle_client_destroy;
+	wl_client_add_destroy_listener(wl_client, &client->destroy);
+	wl_list_insert(&server->clients, &client->link);
+	return client;
+}
+
+/* Returns the accounting of the client owning a surface, if it is tracked */
+struct kwm_client *client_from_surface(struct kwm_server *server, struct wlr_surface *surface) {
+	struct wl_client *wl_client = wl_resource_get_client(surface->resource);
+	struct wl_listener *listener =
+		wl_client_get_destroy_listener(wl_client, handle_client_destroy);
+	if (listener == NULL) {
+		return NULL;
+	}
+	struct kwm_client *client = wl_container_of(listener, client, destroy);
+	return client;
+}
+
+/* Applies the rules matching the app_id of one of the client's toplevels */
+void client_apply_rules(struct kwm_client *client, const char *app_id) {
+	if (client == NULL || app_id == NULL) {
+		return;
+	}
+	int max_fps = rule_max_fps(app_id);
+	if (max_fps != client->max_fps) {
+		wlr_log(WLR_INFO, "Capping client %d (%s) to %d fps", client->pid, app_id, max_fps);
+		client->max_fps = max_fps;
+	}
+}
+
+/* This function is called when a paced client is due for its next frame callback. Frame
+   callbacks are only sent from the output frame handler, so ask for a frame */
+static int handle_client_pace(void *data) {
+	struct kwm_client *client = data;
+	struct kwm_output *output;
+	wl_list_for_each(output, &client->server->outputs, link) {
+		wlr_output_schedule_frame(output->wlr_output);
+	}
+	return 0;
+}
+
+/* Decides whether the frame callbacks of a surface are sent now. Clients above their
+   frame-rate cap keep their callbacks pending until the cap allows the next frame, which
+   throttles any client that renders in response to frame callbacks. All surfaces of a
+   client share the frame they were released in. */
+bool client_frame_done_allowed(struct kwm_server *server, struct wlr_surface *surface,
+							   struct timespec *when) {
+	struct kwm_client *client = client_from_surface(server, surface);
+	if (client == NULL) {
+		return true;
+	}
+
+	if (client->max_fps > 0) {
+		int64_t interval = 1000000000 / client->max_fps;
+		int64_t elapsed = timespec_diff_ns(&client->last_frame_done, when);
+		if (elapsed != 0 && elapsed < interval) {
+			if (client->pace_timer == NULL) {
+				client->pace_timer =
+					clock_add_timer(&server->clock, handle_client_pace, client);
+			}
+			if (client->pace_timer != NULL) {
+				int delay = (interval - elapsed + 999999) / 1000000;
+				clock_timer_update(client->pace_timer, delay);
+			}
+			return false;
+		}
+		client->last_frame_done = *when;
+	}
+
+	client->frame_callbacks += wl_list_length(&surface->current.frame_callback_list);
+	return true;
+}
+
+/* This function is called when a client commits a surface. Besides counting the commit,
+   the damaged part of a shared memory buffer is what gets copied into a texture */
+void handle_client_surface_commit(struct wl_listener *listener, void *data) {
+	struct kwm_client_surface *client_surface = wl_container_of(listener, client_surface, commit);
+	struct kwm_client *client = client_surface->client;
+	struct wlr_surface *surface = client_surface->surface;
+	if (client == NULL) {
+		return;
+	}
+
+	client->commits++;
+	client->window_commits++;
+	struct timespec now;
+	clock_now(&client->server->clock, &now);
+	int64_t window = timespec_diff_ns(&client->window_start, &now);
+	if (window >= 1000000000) {
+		client->commit_rate = client->window_commits * 1e9 / window;
+		client->window_commits = 0;
+		client->window_start = now;
+	}
+
+	if (!(surface->current.committed & WLR_SURFACE_STATE_BUFFER) || surface->buffer == NULL ||
+		surface->buffer->resource == NULL) {
+		return;
+	}
+	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(surface->buffer->resource);
+	if (shm_buffer == NULL || wl_shm_buffer_get_width(shm_buffer) <= 0) {
+		/* Other buffers, such as dmabufs, are imported without a copy */
+		return;
+	}
+	int bpp = wl_shm_buffer_get_stride(shm_buffer) / wl_shm_buffer_get_width(shm_buffer);
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&surface->buffer_damage, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		client->bytes_uploaded +=
+			(uint64_t)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1) * bpp;
+	}
+}
+
+/* This function is called when a tracked surface is destroyed */
+void handle_client_surface_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_client_surface *client_surface =
+		wl_container_of(listener, client_surface, destroy);
+	if (client_surface->client != NULL) {
+		client_surface->client->surface_count--;
+	}
+	wl_list_remove(&client_surface->link);
+	wl_list_remove(&client_surface->commit.link);
+	wl_list_remove(&client_surface->destroy.link);
+	free(client_surface);
+}
+
+/* This function is called whenever a client creates a surface, of any role */
+void handle_new_surface(struct wl_listener *listener, void *data) {
+	struct kwm_server *server = wl_container_of(listener, server, new_surface);
+	struct wlr_surface *surface = data;
+
+	struct kwm_client *client = client_get(server, wl_resource_get_client(surface->resource));
+	if (client == NULL) {
+		return;
+	}
+	struct kwm_client_surface *client_surface = calloc(1, sizeof(struct kwm_client_surface));
+	if (client_surface == NULL) {
+		return;
+	}
+	client_surface->client = client;
+	client_surface->surface = surface;
+	wl_list_insert(&client->surfaces, &client_surface->link);
+	client->surface_count++;
+
+	client_surface->commit.notify = handle_client_surface_commit;
+	wl_signal_add(&surface->events.commit, &client_surface->commit);
+	client_surface->destroy.notify = handle_client_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &client_surface->destroy);
+}
+
+/* This function is called when a client disconnects. Its resources, and so its surfaces,
+   are destroyed after this, so the surfaces are detached from the accounting first */
+void handle_client_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_client *client = wl_container_of(listener, client, destroy);
+	struct kwm_client_surface *client_surface, *tmp;
+	wl_list_for_each_safe(client_surface, tmp, &client->surfaces, link) {
+		client_surface->client = NULL;
+		wl_list_remove(&client_surface->link);
+		wl_list_init(&client_surface->link);
+	}
+	if (client->pace_timer != NULL) {
+		clock_timer_remove(client->pace_timer);
+	}
+	wl_list_remove(&client->destroy.link);
+	wl_list_remove(&client->link);
+	free(client);
+}
+
+/* Logs the texture memory of a view, along with the client it belongs to */
+static void view_dump_stats(struct kwm_view *view) {
+	const char *name = view->type == KWM_VIEW_XDG ? view->xdg_surface->toplevel->app_id
+												   : view->xwayland_surface->class;
+	struct wl_client *wl_client = wl_resource_get_client(view_surface(view)->resource);
+	pid_t pid = 0;
+	wl_client_get_credentials(wl_client, &pid, NULL, NULL);
+	wlr_log(WLR_INFO, "  view %s (pid %d) on %s: %zu texture bytes%s", name ? name : "?", pid,
+			view->output->wlr_output->name, scene_node_texture_bytes(view->scene_tree),
+			view_is_visible(view) ? "" : ", hidden");
+}
+
+/* Logs the resource usage of every client and the texture memory of every view */
+void client_dump_stats(struct kwm_server *server) {
+	wlr_log(WLR_INFO, "Resource usage of %d clients:", wl_list_length(&server->clients));
+	struct kwm_client *client;
+	wl_list_for_each(client, &server->clients, link) {
+		size_t texture_bytes = 0;
+		struct kwm_client_surface *client_surface;
+		wl_list_for_each(client_surface, &client->surfaces, link) {
+			texture_bytes += scene_surface_texture_bytes(client_surface->surface);
+		}
+		wlr_log(WLR_INFO,
+				"  pid %d: %d surfaces, %.1f commits/s, %" PRIu64 " commits, %" PRIu64
+				" bytes uploaded, %zu texture bytes, %" PRIu64 " frame callbacks, cap %d fps",
+				client->pid, client->surface_count, client->commit_rate, client->commits,
+				client->bytes_uploaded, texture_bytes, client->frame_callbacks, client->max_fps);
+	}
+
+	wlr_log(WLR_INFO, "Texture memory: %zu bytes, budget %d MiB", server->scene->texture_bytes,
+			texture_budget);
+	struct kwm_output *output;
+	wl_list_for_each(output, &server->outputs, link) {
+		struct kwm_view *view;
+		wl_list_for_each(view, &output->views, link) {
+			if (view->mapped) {
+				view_dump_stats(view);
+			}
+		}
+	}
+}
+
+/* This function is called when kwm receives SIGUSR1 */
+static int handle_sigusr1(int signal_number, void *data) {
+	struct kwm_server *server = data;
+	client_dump_stats(server);
+	pool_dump_stats(&server->pool);
+	return 0;
+}
+
+/* This function starts tracking the clients. Sending SIGUSR1 to kwm logs their usage and
+   the texture memory of each view */
+void client_accounting_init(struct kwm_server *server) {
+	wl_list_init(&server->clients);
+	server->new_surface.notify = handle_new_surface;
+	wl_signal_add(&server->compositor->events.new_surface, &server->new_surface);
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(server->display);
+	server->sigusr1 = wl_event_loop_add_signal(loop, SIGUSR1, handle_sigusr1, server);
+}
+
+/* This function stops tracking the clients */
+void client_accounting_finish(struct kwm_server *server) {
+	if (server->sigusr1 != NULL) {
+		wl_event_source_remove(server->sigusr1);
+		server->sigusr1 = NULL;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef KWM_CLIENT_H
+#define KWM_CLIENT_H
+
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_surface.h>
+
+struct kwm_server;
+
+/* This struct holds the resource usage of a Wayland client. It is created along with the
+   first surface of the client and freed when the client disconnects */
+struct kwm_client {
+	struct kwm_server *server;
+	struct wl_client *wl_client;
+	struct wl_list link;
+	struct wl_list surfaces;
+	pid_t pid;
+
+	/* Totals since the client connected */
+	uint64_t commits;
+	uint64_t bytes_uploaded;
+	uint64_t frame_callbacks;
+	int surface_count;
+
+	/* Commits per second, measured over windows of at least a second */
+	double commit_rate;
+	uint64_t window_commits;
+	struct timespec window_start;
+
+	/* Frame-rate cap from the rules in config.h, 0 when the client is not capped */
+	int max_fps;
+	struct timespec last_frame_done;
+	struct kwm_timer *pace_timer;
+
+	struct wl_listener destroy;
+};
+
+/* This struct tracks a surface of a client for accounting */
+struct kwm_client_surface {
+	struct kwm_client *client;
+	struct wlr_surface *surface;
+	struct wl_list link;
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+void client_accounting_init(struct kwm_server *server);
+void client_accounting_finish(struct kwm_server *server);
+struct kwm_client *client_from_surface(struct kwm_server *server, struct wlr_surface *surface);
+void client_apply_rules(struct kwm_client *client, const char *app_id);
+bool client_frame_done_allowed(struct kwm_server *server, struct wlr_surface *surface,
+							   struct timespec *when);
+void client_dump_stats(struct kwm_server *server);
+
+void handle_new_surface(struct wl_listener *listener, void *data);
+void handle_client_destroy(struct wl_listener *listener, void *data);
+void handle_client_surface_commit(struct wl_listener *listener, void *data);
+void handle_client_surface_destroy(struct wl_listener *listener, void *data);
+
+#endif
@@ -0,0 +1,199 @@
+#include "clock.h"
+#include "server.h"
+#include "kwm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+static void timespec_add_ms(struct timespec *ts, long ms) {
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static bool timespec_before(struct timespec *a, struct timespec *b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* This function is called with the commands of the test driver. Each line is a number of
+   milliseconds to advance the clock by, or a command server_driver_command knows. Once the
+   timers and frames that fell due ran, or the command did, the time is written back in
+   milliseconds, so the driver can wait for it. The driver going away ends the session. */
+static int handle_clock_driver(int fd, uint32_t mask, void *data) {
+	struct kwm_clock *clock = data;
+	char buf[256];
+	ssize_t n = 0;
+	if (mask & WL_EVENT_READABLE) {
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+			return 0;
+		}
+	}
+	if (n <= 0) {
+		wlr_log(WLR_INFO, "Clock driver is gone, exiting");
+		kwm_exit(clock->server, NULL);
+		wl_event_source_remove(clock->driver);
+		clock->driver = NULL;
+		return 0;
+	}
+
+	for (ssize_t i = 0; i < n; i++) {
+		if (buf[i] != '\n') {
+			if (clock->line_len < sizeof(clock->line) - 1) {
+				clock->line[clock->line_len++] = buf[i];
+			}
+			continue;
+		}
+		clock->line[clock->line_len] = '\0';
+		clock->line_len = 0;
+		char *end;
+		long ms = strtol(clock->line, &end, 10);
+		if (end != clock->line && ms >= 0) {
+			clock_advance(clock, ms);
+		} else if (!server_driver_command(clock->server, clock->line)) {
+			wlr_log(WLR_ERROR, "Invalid clock command '%s'", clock->line);
+			continue;
+		}
+		dprintf(clock->driver_out, "%ld\n",
+				clock->now.tv_sec * 1000 + clock->now.tv_nsec / 1000000);
+	}
+	return 0;
+}
+
+/* This function sets up the clock. kwm sets clock->virtual beforehand to run on virtual
+   time, which starts at zero */
+bool clock_init(struct kwm_clock *clock, struct kwm_server *server) {
+	clock->server = server;
+	clock->driver_in = clock->driver_out = -1;
+	wl_list_init(&clock->timers);
+	if (!clock->virtual) {
+		return true;
+	}
+
+	/* Clients and Xwayland inherit stdin and stdout. They must neither read the commands
+	   nor write into the replies, so kwm talks to the driver through copies closed on exec */
+	clock->driver_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	clock->driver_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+	if (clock->driver_in < 0 || clock->driver_out < 0 || null < 0 ||
+		dup2(null, STDIN_FILENO) < 0 || dup2(null, STDOUT_FILENO) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to set up the clock driver");
+		if (null >= 0) {
+			close(null);
+		}
+		return false;
+	}
+	close(null);
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(server->display);
+	clock->driver = wl_event_loop_add_fd(loop, clock->driver_in, WL_EVENT_READABLE,
+										 handle_clock_driver, clock);
+	if (clock->driver == NULL) {
+		wlr_log(WLR_ERROR, "Failed to read clock commands from stdin");
+		return false;
+	}
+	wlr_log(WLR_INFO, "Running on a virtual clock driven from stdin");
+	return true;
+}
+
+void clock_finish(struct kwm_clock *clock) {
+	if (clock->driver != NULL) {
+		wl_event_source_remove(clock->driver);
+		clock->driver = NULL;
+	}
+	if (clock->driver_in >= 0) {
+		close(clock->driver_in);
+		clock->driver_in = -1;
+	}
+	if (clock->driver_out >= 0) {
+		close(clock->driver_out);
+		clock->driver_out = -1;
+	}
+}
+
+/* Returns the current time of the clock */
+void clock_now(struct kwm_clock *clock, struct timespec *now) {
+	if (clock->virtual) {
+		*now = clock->now;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, now);
+	}
+}
+
+/* This function moves virtual time forwards. The timers falling due run in order, each one
+   at its own deadline, so a timer armed by another one runs within the same call if it is
+   due. Advancing by more than a frame runs the frames back to back, without waiting for
+   clients to answer them. */
+void clock_advance(struct kwm_clock *clock, long ms) {
+	struct timespec target = clock->now;
+	timespec_add_ms(&target, ms);
+	while (true) {
+		struct kwm_timer *next = NULL, *timer;
+		wl_list_for_each(timer, &clock->timers, link) {
+			if (timer->armed && !timespec_before(&target, &timer->deadline) &&
+				(next == NULL || timespec_before(&timer->deadline, &next->deadline))) {
+				next = timer;
+			}
+		}
+		if (next == NULL) {
+			break;
+		}
+		if (timespec_before(&clock->now, &next->deadline)) {
+			clock->now = next->deadline;
+		}
+		next->armed = false;
+		next->func(next->data);
+	}
+	clock->now = target;
+}
+
+/* Creates a disarmed timer which calls func when it expires */
+struct kwm_timer *clock_add_timer(struct kwm_clock *clock, wl_event_loop_timer_func_t func,
+								  void *data) {
+	struct kwm_timer *timer = calloc(1, sizeof(struct kwm_timer));
+	if (timer == NULL) {
+		return NULL;
+	}
+	timer->clock = clock;
+	timer->func = func;
+	timer->data = data;
+	if (clock->virtual) {
+		wl_list_insert(clock->timers.prev, &timer->link);
+		return timer;
+	}
+
+	wl_list_init(&timer->link);
+	struct wl_event_loop *loop = wl_display_get_event_loop(clock->server->display);
+	timer->source = wl_event_loop_add_timer(loop, func, data);
+	if (timer->source == NULL) {
+		free(timer);
+		return NULL;
+	}
+	return timer;
+}
+
+/* Arms a timer to expire in the given number of milliseconds, 0 disarms it */
+void clock_timer_update(struct kwm_timer *timer, int ms) {
+	if (timer->source != NULL) {
+		wl_event_source_timer_update(timer->source, ms);
+		return;
+	}
+	timer->armed = ms > 0;
+	timer->deadline = timer->clock->now;
+	timespec_add_ms(&timer->deadline, ms);
+}
+
+void clock_timer_remove(struct kwm_timer *timer) {
+	if (timer->source != NULL) {
+		wl_event_source_remove(timer->source);
+	}
+	wl_list_remove(&timer->link);
+	free(timer);
+}
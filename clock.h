@@ -0,0 +1,50 @@
+#ifndef KWM_CLOCK_H
+#define KWM_CLOCK_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <wayland-server.h>
+
+struct kwm_server;
+
+/* This struct holds the clock kwm measures time and arms timers with. It is the monotonic
+   clock, unless kwm runs with a virtual clock which only advances when a test driver says so */
+struct kwm_clock {
+	struct kwm_server *server;
+	bool virtual;
+
+	/* Virtual time, and the timers armed on it */
+	struct timespec now;
+	struct wl_list timers;
+
+	/* Commands of the test driver, read from stdin, and the replies written to stdout. kwm
+	   keeps its own copies of both, children get /dev/null in their place */
+	struct wl_event_source *driver;
+	int driver_in, driver_out;
+	char line[64];
+	size_t line_len;
+};
+
+/* A timer on the kwm clock. With the monotonic clock it is an event loop timer */
+struct kwm_timer {
+	struct kwm_clock *clock;
+	wl_event_loop_timer_func_t func;
+	void *data;
+
+	struct wl_event_source *source;
+	bool armed;
+	struct timespec deadline;
+	struct wl_list link;
+};
+
+bool clock_init(struct kwm_clock *clock, struct kwm_server *server);
+void clock_finish(struct kwm_clock *clock);
+void clock_now(struct kwm_clock *clock, struct timespec *now);
+void clock_advance(struct kwm_clock *clock, long ms);
+
+struct kwm_timer *clock_add_timer(struct kwm_clock *clock, wl_event_loop_timer_func_t func,
+								  void *data);
+void clock_timer_update(struct kwm_timer *timer, int ms);
+void clock_timer_remove(struct kwm_timer *timer);
+
+#endif
@@ -5,11 +5,79 @@
 
 #define MODKEY		WLR_MODIFIER_ALT
 #define SHIFTKEY	WLR_MODIFIER_SHIFT
+#define CTRLKEY		WLR_MODIFIER_CTRL
+#define TAGKEYS(KEY, SKEY, TAG) \
+	{ MODKEY,					KEY,	kwm_view_tags,			{ .ui = 1 << TAG } }, \
+	{ MODKEY|CTRLKEY,			KEY,	kwm_toggle_view_tags,	{ .ui = 1 << TAG } }, \
+	{ MODKEY|SHIFTKEY,			SKEY,	kwm_tag_view,			{ .ui = 1 << TAG } }, \
+	{ MODKEY|CTRLKEY|SHIFTKEY,	SKEY,	kwm_toggle_tag_view,	{ .ui = 1 << TAG } },
+
+/* Rounds of dispatching per main loop iteration before clients are flushed again. Input is
+   drained after every round. This does not count requests: a round handles every ready
+   source, and each ready client with as many requests as libwayland reads from its socket
+   at once, at most one connection buffer of 4 KiB */
+const int event_loop_budget = 4;
+
+/* Milliseconds a main loop iteration may take before the watchdog reports a stall, 0 for no
+   watchdog. Reports name the phase, the last client request and the listener that ran, and
+   go to a log which is moved to watchdog_log.old once it exceeds watchdog_log_size KiB. A
+   relative watchdog_log is in XDG_RUNTIME_DIR */
+const int watchdog_threshold = 200;
+const char watchdog_log[] = "kwm-stalls.log";
+const int watchdog_log_size = 1024;
+
+/* Seconds without input after which composition stops and outputs are powered down, 0 for
+   never. Outputs are only powered down once composition stopped. Clients holding an idle
+   inhibitor on a visible view keep the session awake */
+const int idle_timeout = 300;
+const int idle_dpms_timeout = 600;
+
+/* Threads compiling keymaps and loading cursor themes off the main loop. With 0, that work
+   runs on the main loop */
+const int worker_threads = 2;
+
+/* Draw the scene on the CPU, for hosts without a GPU where the renderer runs in software.
+   Only rotated surfaces and buffers other than shared memory are left to the renderer */
+const int software_rendering = 0;
+
+/* Megabytes of client buffers kept in memory, counting both the texture of each surface and
+   the copy of its buffer kwm keeps. Above this, the textures of hidden views are released,
+   least recently shown first, and uploaded again from the copy when the view is shown. 0 for
+   no limit, and no copies unless software_rendering is set */
+const int texture_budget = 512;
+
+/* Seconds without any X window after which Xwayland is stopped, 0 keeps it running */
+const int xwayland_idle_timeout = 300;
 
 static const char *termcmd[] = { "alacritty", NULL };
 const keybind keybinds[] = {
 	{ MODKEY,			XKB_KEY_Return,		kwm_spawn_process,		{ .v = termcmd } },
-	{ MODKEY|SHIFTKEY,	XKB_KEY_E,			kwm_exit,				{0} }
+	{ MODKEY|SHIFTKEY,	XKB_KEY_E,			kwm_exit,				{0} },
+	{ MODKEY,			XKB_KEY_Tab,		kwm_focus_next,			{0} },
+	{ MODKEY,			XKB_KEY_0,			kwm_view_tags,			{ .ui = ~0u } },
+	{ MODKEY|SHIFTKEY,	XKB_KEY_parenright,	kwm_tag_view,			{ .ui = ~0u } },
+	TAGKEYS(			XKB_KEY_1,			XKB_KEY_exclam,					0)
+	TAGKEYS(			XKB_KEY_2,			XKB_KEY_at,						1)
+	TAGKEYS(			XKB_KEY_3,			XKB_KEY_numbersign,				2)
+	TAGKEYS(			XKB_KEY_4,			XKB_KEY_dollar,					3)
+	TAGKEYS(			XKB_KEY_5,			XKB_KEY_percent,				4)
+	TAGKEYS(			XKB_KEY_6,			XKB_KEY_asciicircum,			5)
+	TAGKEYS(			XKB_KEY_7,			XKB_KEY_ampersand,				6)
+	TAGKEYS(			XKB_KEY_8,			XKB_KEY_asterisk,				7)
+	TAGKEYS(			XKB_KEY_9,			XKB_KEY_parenleft,				8)
+};
+
+/* Scale of outputs by name. Clients supporting fractional scaling render at exactly the
+   physical size of fractionally scaled outputs */
+const output_rule output_rules[] = {
+	/* name			scale */
+	{ "eDP-1",		1.5 },
+};
+
+/* Frame callbacks of clients with a matching app_id are sent at most max_fps times a second */
+const rule rules[] = {
+	/* app_id			max_fps */
+	{ "glxgears",		30 },
 };
 
 #endif
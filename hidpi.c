@@ -0,0 +1,364 @@
+#include "hidpi.h"
+#include "server.h"
+#include "fractional-scale-v1-protocol.h"
+#include "viewporter-protocol.h"
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+
+/* wlroots does not offer wp_viewporter nor wp_fractional_scale_v1 yet, so kwm implements
+   both. Together they let a client draw at exactly the physical pixel size of a fractionally
+   scaled output: it renders a buffer of scale times its logical size and sets the logical
+   size as viewport destination, which the scene then maps pixel for pixel onto the output */
+
+static void handle_viewport_surface_commit(struct wl_listener *listener, void *data);
+static void handle_viewport_surface_destroy(struct wl_listener *listener, void *data);
+static void handle_fractional_scale_surface_destroy(struct wl_listener *listener, void *data);
+
+/* Looks up the viewport of a surface. The destroy listener links the two */
+static struct kwm_viewport *viewport_from_surface(struct wlr_surface *surface) {
+	struct wl_listener *listener =
+		wl_signal_get(&surface->events.destroy, handle_viewport_surface_destroy);
+	if (listener == NULL) {
+		return NULL;
+	}
+	struct kwm_viewport *viewport = wl_container_of(listener, viewport, surface_destroy);
+	return viewport;
+}
+
+static struct kwm_fractional_scale *fractional_scale_from_surface(struct wlr_surface *surface) {
+	struct wl_listener *listener =
+		wl_signal_get(&surface->events.destroy, handle_fractional_scale_surface_destroy);
+	if (listener == NULL) {
+		return NULL;
+	}
+	struct kwm_fractional_scale *fractional_scale =
+		wl_container_of(listener, fractional_scale, surface_destroy);
+	return fractional_scale;
+}
+
+/* Returns the size of a surface in layout coordinates, which is the viewport destination if
+   the client set one */
+void surface_get_size(struct wlr_surface *surface, int *width, int *height) {
+	*width = surface->current.width, *height = surface->current.height;
+	struct kwm_viewport *viewport = viewport_from_surface(surface);
+	if (viewport == NULL) {
+		return;
+	}
+	if (viewport->current.dst_width > 0) {
+		*width = viewport->current.dst_width, *height = viewport->current.dst_height;
+	} else if (viewport->current.src.width > 0) {
+		*width = viewport->current.src.width, *height = viewport->current.src.height;
+	}
+}
+
+/* Returns the part of the buffer a surface shows, in buffer pixels. Returns false if the
+   surface has no viewport and simply shows its whole buffer */
+bool surface_get_source_box(struct wlr_surface *surface, struct wlr_fbox *box) {
+	int scale = surface->current.scale;
+	box->x = box->y = 0;
+	box->width = surface->current.buffer_width;
+	box->height = surface->current.buffer_height;
+
+	struct kwm_viewport *viewport = viewport_from_surface(surface);
+	if (viewport == NULL ||
+		(viewport->current.src.width <= 0 && viewport->current.dst_width <= 0)) {
+		return false;
+	}
+	if (viewport->current.src.width > 0) {
+		/* Rotated buffers are sampled whole, kwm does not crop them */
+		if (surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+			return true;
+		}
+		box->x = viewport->current.src.x * scale;
+		box->y = viewport->current.src.y * scale;
+		box->width = viewport->current.src.width * scale;
+		box->height = viewport->current.src.height * scale;
+	}
+	return true;
+}
+
+/* Tells a client the scale of the output its surface is shown on. Clients without a
+   fractional scale object rely on wl_surface.enter and the integer wl_output scale */
+void surface_set_preferred_scale(struct wlr_surface *surface, float scale) {
+	struct kwm_fractional_scale *fractional_scale = fractional_scale_from_surface(surface);
+	if (fractional_scale == NULL || fractional_scale->resource == NULL) {
+		return;
+	}
+	uint32_t scale_120 = round(scale * 120);
+	if (fractional_scale->scale_120 == scale_120) {
+		return;
+	}
+	fractional_scale->scale_120 = scale_120;
+	wp_fractional_scale_v1_send_preferred_scale(fractional_scale->resource, scale_120);
+}
+
+static void viewport_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void viewport_handle_set_source(struct wl_client *client, struct wl_resource *resource,
+									   wl_fixed_t x, wl_fixed_t y, wl_fixed_t width,
+									   wl_fixed_t height) {
+	struct kwm_viewport *viewport = wl_resource_get_user_data(resource);
+	if (viewport == NULL) {
+		wl_resource_post_error(resource, WP_VIEWPORT_ERROR_NO_SURFACE, "surface destroyed");
+		return;
+	}
+
+	struct wlr_fbox src = {
+		.x = wl_fixed_to_double(x),
+		.y = wl_fixed_to_double(y),
+		.width = wl_fixed_to_double(width),
+		.height = wl_fixed_to_double(height),
+	};
+	if (src.x == -1 && src.y == -1 && src.width == -1 && src.height == -1) {
+		viewport->pending.src = (struct wlr_fbox){0};
+		return;
+	}
+	if (src.x < 0 || src.y < 0 || src.width <= 0 || src.height <= 0) {
+		wl_resource_post_error(resource, WP_VIEWPORT_ERROR_BAD_VALUE,
+							   "invalid source rectangle");
+		return;
+	}
+	viewport->pending.src = src;
+}
+
+static void viewport_handle_set_destination(struct wl_client *client,
+											struct wl_resource *resource, int32_t width,
+											int32_t height) {
+	struct kwm_viewport *viewport = wl_resource_get_user_data(resource);
+	if (viewport == NULL) {
+		wl_resource_post_error(resource, WP_VIEWPORT_ERROR_NO_SURFACE, "surface destroyed");
+		return;
+	}
+
+	if (width == -1 && height == -1) {
+		viewport->pending.dst_width = viewport->pending.dst_height = 0;
+		return;
+	}
+	if (width <= 0 || height <= 0) {
+		wl_resource_post_error(resource, WP_VIEWPORT_ERROR_BAD_VALUE, "invalid destination");
+		return;
+	}
+	viewport->pending.dst_width = width, viewport->pending.dst_height = height;
+}
+
+static const struct wp_viewport_interface viewport_impl = {
+	.destroy = viewport_handle_destroy,
+	.set_source = viewport_handle_set_source,
+	.set_destination = viewport_handle_set_destination,
+};
+
+static void viewport_free(struct kwm_viewport *viewport) {
+	wl_list_remove(&viewport->surface_commit.link);
+	wl_list_remove(&viewport->surface_destroy.link);
+	free(viewport);
+}
+
+/* The viewport is reset with the next commit of the surface */
+static void viewport_handle_resource_destroy(struct wl_resource *resource) {
+	struct kwm_viewport *viewport = wl_resource_get_user_data(resource);
+	if (viewport == NULL) {
+		return;
+	}
+	viewport->resource = NULL;
+	viewport->pending = (struct kwm_viewport_state){0};
+}
+
+/* This function is called when a surface with a viewport commits. It runs ahead of every
+   other commit listener, so that the scene already sees the new viewport */
+static void handle_viewport_surface_commit(struct wl_listener *listener, void *data) {
+	struct kwm_viewport *viewport = wl_container_of(listener, viewport, surface_commit);
+	struct wlr_surface *surface = viewport->surface;
+	viewport->current = viewport->pending;
+	if (viewport->resource == NULL) {
+		viewport_free(viewport);
+		return;
+	}
+
+	struct wlr_fbox *src = &viewport->current.src;
+	if (src->width <= 0) {
+		return;
+	}
+	if (viewport->current.dst_width <= 0 &&
+		(src->width != (int)src->width || src->height != (int)src->height)) {
+		wl_resource_post_error(viewport->resource, WP_VIEWPORT_ERROR_BAD_SIZE,
+							   "source size is not integer and no destination is set");
+		return;
+	}
+	if (!wlr_surface_has_buffer(surface)) {
+		return;
+	}
+	int width = surface->current.buffer_width, height = surface->current.buffer_height;
+	if (surface->current.transform % 2 == 1) {
+		/* Rotated by 90 or 270 degrees */
+		width = surface->current.buffer_height, height = surface->current.buffer_width;
+	}
+	width /= surface->current.scale, height /= surface->current.scale;
+	if (src->x + src->width > width || src->y + src->height > height) {
+		wl_resource_post_error(viewport->resource, WP_VIEWPORT_ERROR_OUT_OF_BUFFER,
+							   "source rectangle extends outside of the buffer");
+	}
+}
+
+static void handle_viewport_surface_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_viewport *viewport = wl_container_of(listener, viewport, surface_destroy);
+	if (viewport->resource != NULL) {
+		wl_resource_set_user_data(viewport->resource, NULL);
+	}
+	viewport_free(viewport);
+}
+
+static void viewporter_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void viewporter_handle_get_viewport(struct wl_client *client,
+										   struct wl_resource *resource, uint32_t id,
+										   struct wl_resource *surface_resource) {
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+	struct kwm_viewport *viewport = viewport_from_surface(surface);
+	if (viewport != NULL && viewport->resource != NULL) {
+		wl_resource_post_error(resource, WP_VIEWPORTER_ERROR_VIEWPORT_EXISTS,
+							   "surface already has a viewport");
+		return;
+	}
+
+	struct wl_resource *viewport_resource =
+		wl_resource_create(client, &wp_viewport_interface, wl_resource_get_version(resource), id);
+	if (viewport_resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	/* A viewport destroyed since the last commit is picked up again */
+	if (viewport == NULL) {
+		viewport = calloc(1, sizeof(struct kwm_viewport));
+		if (viewport == NULL) {
+			wl_resource_destroy(viewport_resource);
+			wl_client_post_no_memory(client);
+			return;
+		}
+		viewport->surface = surface;
+		viewport->surface_commit.notify = handle_viewport_surface_commit;
+		wl_list_insert(&surface->events.commit.listener_list, &viewport->surface_commit.link);
+		viewport->surface_destroy.notify = handle_viewport_surface_destroy;
+		wl_signal_add(&surface->events.destroy, &viewport->surface_destroy);
+	}
+	viewport->resource = viewport_resource;
+	wl_resource_set_implementation(viewport_resource, &viewport_impl, viewport,
+								   viewport_handle_resource_destroy);
+}
+
+static const struct wp_viewporter_interface viewporter_impl = {
+	.destroy = viewporter_handle_destroy,
+	.get_viewport = viewporter_handle_get_viewport,
+};
+
+static void viewporter_bind(struct wl_client *client, void *data, uint32_t version,
+							uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wp_viewporter_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &viewporter_impl, data, NULL);
+}
+
+static void fractional_scale_handle_destroy(struct wl_client *client,
+											struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl = {
+	.destroy = fractional_scale_handle_destroy,
+};
+
+static void fractional_scale_handle_resource_destroy(struct wl_resource *resource) {
+	struct kwm_fractional_scale *fractional_scale = wl_resource_get_user_data(resource);
+	if (fractional_scale == NULL) {
+		return;
+	}
+	wl_list_remove(&fractional_scale->surface_destroy.link);
+	free(fractional_scale);
+}
+
+static void handle_fractional_scale_surface_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_fractional_scale *fractional_scale =
+		wl_container_of(listener, fractional_scale, surface_destroy);
+	wl_resource_set_user_data(fractional_scale->resource, NULL);
+	wl_list_remove(&fractional_scale->surface_destroy.link);
+	free(fractional_scale);
+}
+
+static void fractional_scale_manager_handle_destroy(struct wl_client *client,
+													struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void fractional_scale_manager_handle_get(struct wl_client *client,
+												struct wl_resource *resource, uint32_t id,
+												struct wl_resource *surface_resource) {
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+	if (fractional_scale_from_surface(surface) != NULL) {
+		wl_resource_post_error(resource,
+							   WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS,
+							   "surface already has a fractional scale object");
+		return;
+	}
+
+	struct kwm_fractional_scale *fractional_scale = calloc(1, sizeof(struct kwm_fractional_scale));
+	if (fractional_scale == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	fractional_scale->resource = wl_resource_create(
+		client, &wp_fractional_scale_v1_interface, wl_resource_get_version(resource), id);
+	if (fractional_scale->resource == NULL) {
+		free(fractional_scale);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	fractional_scale->surface = surface;
+	wl_resource_set_implementation(fractional_scale->resource, &fractional_scale_impl,
+								   fractional_scale, fractional_scale_handle_resource_destroy);
+	fractional_scale->surface_destroy.notify = handle_fractional_scale_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &fractional_scale->surface_destroy);
+
+	/* Clients usually ask once their surface is shown, it is not going to enter the output
+	   again to learn the scale */
+	struct wlr_output *output = scene_surface_get_output(surface);
+	if (output != NULL) {
+		surface_set_preferred_scale(surface, output->scale);
+	}
+}
+
+static const struct wp_fractional_scale_manager_v1_interface fractional_scale_manager_impl = {
+	.destroy = fractional_scale_manager_handle_destroy,
+	.get_fractional_scale = fractional_scale_manager_handle_get,
+};
+
+static void fractional_scale_manager_bind(struct wl_client *client, void *data,
+										  uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wp_fractional_scale_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &fractional_scale_manager_impl, data, NULL);
+}
+
+/* This function creates the wp_viewporter and wp_fractional_scale_manager_v1 globals */
+void hidpi_init(struct kwm_server *server) {
+	if (wl_global_create(server->display, &wp_viewporter_interface, 1, server,
+						 viewporter_bind) == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create the wp_viewporter global");
+	}
+	if (wl_global_create(server->display, &wp_fractional_scale_manager_v1_interface, 1, server,
+						 fractional_scale_manager_bind) == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create the wp_fractional_scale_manager_v1 global");
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef KWM_HIDPI_H
+#define KWM_HIDPI_H
+
+#include <wayland-server.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_surface.h>
+
+struct kwm_server;
+
+/* Crop and scale state of a surface, as set through wp_viewport */
+struct kwm_viewport_state {
+	/* Source rectangle in surface coordinates, unset when the width is 0 */
+	struct wlr_fbox src;
+	/* Destination size, unset when 0 */
+	int dst_width, dst_height;
+};
+
+/* This struct holds the wp_viewport of a surface. It outlives its resource until the next
+   commit, since destroying a viewport only takes effect then */
+struct kwm_viewport {
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+	struct kwm_viewport_state pending, current;
+
+	struct wl_listener surface_commit;
+	struct wl_listener surface_destroy;
+};
+
+/* This struct holds the wp_fractional_scale_v1 of a surface */
+struct kwm_fractional_scale {
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+	/* Last scale sent to the client, in 120ths */
+	uint32_t scale_120;
+
+	struct wl_listener surface_destroy;
+};
+
+void hidpi_init(struct kwm_server *server);
+void surface_get_size(struct wlr_surface *surface, int *width, int *height);
+bool surface_get_source_box(struct wlr_surface *surface, struct wlr_fbox *box);
+void surface_set_preferred_scale(struct wlr_surface *surface, float scale);
+
+#endif
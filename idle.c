@@ -0,0 +1,182 @@
+#include "idle.h"
+#include "server.h"
+#include "kwm.h"
+#include <stdlib.h>
+#include <wlr/util/log.h>
+
+/* Returns the time elapsed between two timestamps in milliseconds */
+static long timespec_diff_ms(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Returns the milliseconds of inactivity after which outputs are powered down, 0 for never */
+static long idle_dpms_ms(void) {
+	if (idle_dpms_timeout <= 0) {
+		return 0;
+	}
+	return (idle_dpms_timeout > idle_timeout ? idle_dpms_timeout : idle_timeout) * 1000L;
+}
+
+/* Checks whether an inhibitor holds the session awake. Only inhibitors of views that are
+   shown on an output count, a hidden video player does not keep the screen on */
+static bool idle_inhibitor_active(struct kwm_idle_inhibitor *inhibitor) {
+	struct wlr_surface *surface = wlr_surface_get_root_surface(inhibitor->wlr_inhibitor->surface);
+	struct kwm_output *output;
+	wl_list_for_each(output, &inhibitor->idle->server->outputs, link) {
+		struct kwm_view *view;
+		wl_list_for_each(view, &output->views, link) {
+			if (view_is_visible(view) && view_surface(view) == surface) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool idle_inhibited(struct kwm_idle *idle) {
+	struct kwm_idle_inhibitor *inhibitor;
+	wl_list_for_each(inhibitor, &idle->inhibitors, link) {
+		if (idle_inhibitor_active(inhibitor)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Stops composition. handle_output_frame renders nothing from now on, so clients no longer
+   get frame callbacks either */
+static void idle_stop(struct kwm_idle *idle) {
+	wlr_log(WLR_INFO, "Idle for %d seconds, stopping composition", idle_timeout);
+	idle->state = KWM_IDLE_STOPPED;
+}
+
+/* Powers down all outputs */
+static void idle_power_down(struct kwm_idle *idle) {
+	wlr_log(WLR_INFO, "Idle for %ld seconds, powering down outputs", idle_dpms_ms() / 1000);
+	idle->state = KWM_IDLE_DPMS;
+	struct kwm_output *output;
+	wl_list_for_each(output, &idle->server->outputs, link) {
+		wlr_output_enable(output->wlr_output, false);
+		wlr_output_commit(output->wlr_output);
+	}
+}
+
+/* Powers the outputs back up if needed and repaints them all */
+static void idle_wake(struct kwm_idle *idle) {
+	wlr_log(WLR_INFO, "Waking up from idle");
+	struct kwm_output *output;
+	wl_list_for_each(output, &idle->server->outputs, link) {
+		if (idle->state == KWM_IDLE_DPMS) {
+			wlr_output_enable(output->wlr_output, true);
+			wlr_output_commit(output->wlr_output);
+		}
+		wlr_output_damage_add_whole(output->damage);
+	}
+	idle->state = KWM_IDLE_ACTIVE;
+	clock_timer_update(idle->timer, idle_timeout * 1000);
+}
+
+/* This function is called when the idle timer expires. Activity since it was armed only
+   moved last_activity, so the timer is re-armed for the remaining time in that case */
+static int handle_idle_timer(void *data) {
+	struct kwm_idle *idle = data;
+	struct timespec now;
+	clock_now(&idle->server->clock, &now);
+
+	if (idle->state != KWM_IDLE_DPMS && idle_inhibited(idle)) {
+		idle->last_activity = now;
+		clock_timer_update(idle->timer, idle_timeout * 1000);
+		return 0;
+	}
+
+	long idle_ms = timespec_diff_ms(&idle->last_activity, &now);
+	if (idle->state == KWM_IDLE_ACTIVE) {
+		if (idle_ms < idle_timeout * 1000L) {
+			clock_timer_update(idle->timer, idle_timeout * 1000L - idle_ms);
+			return 0;
+		}
+		idle_stop(idle);
+	}
+	long dpms_ms = idle_dpms_ms();
+	if (idle->state == KWM_IDLE_STOPPED && dpms_ms > 0) {
+		if (idle_ms < dpms_ms) {
+			clock_timer_update(idle->timer, dpms_ms - idle_ms);
+			return 0;
+		}
+		idle_power_down(idle);
+	}
+	return 0;
+}
+
+/* This function is called by the input handlers. It only takes the time, unless the
+   session has to wake up */
+void idle_notify_activity(struct kwm_idle *idle) {
+	clock_now(&idle->server->clock, &idle->last_activity);
+	if (idle->state != KWM_IDLE_ACTIVE) {
+		idle_wake(idle);
+	}
+}
+
+/* This function is called whenever a surface of an inhibiting client commits. A video
+   player coming back to life wakes the session up as input would */
+void handle_idle_inhibitor_commit(struct wl_listener *listener, void *data) {
+	struct kwm_idle_inhibitor *inhibitor = wl_container_of(listener, inhibitor, commit);
+	if (inhibitor->idle->state != KWM_IDLE_ACTIVE && idle_inhibitor_active(inhibitor)) {
+		idle_notify_activity(inhibitor->idle);
+	}
+}
+
+/* This function is called when an inhibitor goes away */
+void handle_idle_inhibitor_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_idle_inhibitor *inhibitor = wl_container_of(listener, inhibitor, destroy);
+	wl_list_remove(&inhibitor->link);
+	wl_list_remove(&inhibitor->commit.link);
+	wl_list_remove(&inhibitor->destroy.link);
+	free(inhibitor);
+}
+
+/* This function is called when a client asks to keep the session awake */
+void handle_new_idle_inhibitor(struct wl_listener *listener, void *data) {
+	struct kwm_idle *idle = wl_container_of(listener, idle, new_inhibitor);
+	struct wlr_idle_inhibitor_v1 *wlr_inhibitor = data;
+
+	struct kwm_idle_inhibitor *inhibitor = calloc(1, sizeof(struct kwm_idle_inhibitor));
+	if (inhibitor == NULL) {
+		return;
+	}
+	inhibitor->idle = idle;
+	inhibitor->wlr_inhibitor = wlr_inhibitor;
+	wl_list_insert(&idle->inhibitors, &inhibitor->link);
+
+	inhibitor->commit.notify = handle_idle_inhibitor_commit;
+	wl_signal_add(&wlr_inhibitor->surface->events.commit, &inhibitor->commit);
+	inhibitor->destroy.notify = handle_idle_inhibitor_destroy;
+	wl_signal_add(&wlr_inhibitor->events.destroy, &inhibitor->destroy);
+}
+
+/* This function sets up idle tracking and the idle-inhibit protocol */
+void idle_init(struct kwm_idle *idle, struct kwm_server *server) {
+	idle->server = server;
+	idle->state = KWM_IDLE_ACTIVE;
+	clock_now(&server->clock, &idle->last_activity);
+	wl_list_init(&idle->inhibitors);
+
+	idle->inhibit_manager = wlr_idle_inhibit_v1_create(server->display);
+	idle->new_inhibitor.notify = handle_new_idle_inhibitor;
+	wl_signal_add(&idle->inhibit_manager->events.new_inhibitor, &idle->new_inhibitor);
+
+	if (idle_timeout > 0) {
+		idle->timer = clock_add_timer(&server->clock, handle_idle_timer, idle);
+		if (idle->timer != NULL) {
+			clock_timer_update(idle->timer, idle_timeout * 1000);
+		}
+	}
+}
+
+/* This function stops idle tracking */
+void idle_finish(struct kwm_idle *idle) {
+	if (idle->timer != NULL) {
+		clock_timer_remove(idle->timer);
+		idle->timer = NULL;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef KWM_IDLE_H
+#define KWM_IDLE_H
+
+#include <time.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_idle_inhibit_v1.h>
+
+struct kwm_server;
+
+enum kwm_idle_state {
+	/* Outputs are composited as usual */
+	KWM_IDLE_ACTIVE,
+	/* Nothing is rendered and clients get no frame callbacks, outputs keep their last frame */
+	KWM_IDLE_STOPPED,
+	/* Outputs are powered down */
+	KWM_IDLE_DPMS,
+};
+
+/* This struct holds the idle state of the session. Input handlers only record the time of
+   the last activity, the timer checks it when it expires and re-arms itself if needed */
+struct kwm_idle {
+	struct kwm_server *server;
+	enum kwm_idle_state state;
+	struct timespec last_activity;
+	struct kwm_timer *timer;
+
+	struct wlr_idle_inhibit_manager_v1 *inhibit_manager;
+	struct wl_list inhibitors;
+
+	struct wl_listener new_inhibitor;
+};
+
+/* This struct holds the state of an idle inhibitor, such as a video player */
+struct kwm_idle_inhibitor {
+	struct kwm_idle *idle;
+	struct wlr_idle_inhibitor_v1 *wlr_inhibitor;
+	struct wl_list link;
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+void idle_init(struct kwm_idle *idle, struct kwm_server *server);
+void idle_finish(struct kwm_idle *idle);
+void idle_notify_activity(struct kwm_idle *idle);
+
+void handle_new_idle_inhibitor(struct wl_listener *listener, void *data);
+void handle_idle_inhibitor_commit(struct wl_listener *listener, void *data);
+void handle_idle_inhibitor_destroy(struct wl_listener *listener, void *data);
+
+#endif
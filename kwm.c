@@ -2,6 +2,7 @@
 #include "kwm.h"
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/util/log.h>
 #include "config.h"
 
@@ -19,12 +20,52 @@ void kwm_spawn_process(struct kwm_server *server, const arg *arg) {
 
 void kwm_exit(struct kwm_server *server, const arg *arg) {
 	wlr_log(WLR_INFO, "Exiting kwm");
-	wl_display_terminate(server->display);
+	loop_stop(&server->loop);
 }
 
 void kwm_kill_view(struct kwm_server *server, const arg *arg) {
 }
 
+void kwm_view_tags(struct kwm_server *server, const arg *arg) {
+	struct kwm_output *output = output_at_cursor(server);
+	if (output == NULL) {
+		return;
+	}
+	output_set_tags(output, arg->ui & KWM_TAGMASK);
+}
+
+void kwm_toggle_view_tags(struct kwm_server *server, const arg *arg) {
+	struct kwm_output *output = output_at_cursor(server);
+	if (output == NULL) {
+		return;
+	}
+	output_set_tags(output, (output->tags ^ arg->ui) & KWM_TAGMASK);
+}
+
+void kwm_tag_view(struct kwm_server *server, const arg *arg) {
+	if (server->focused_view == NULL) {
+		return;
+	}
+	view_set_tags(server->focused_view, arg->ui & KWM_TAGMASK);
+}
+
+void kwm_toggle_tag_view(struct kwm_server *server, const arg *arg) {
+	struct kwm_view *view = server->focused_view;
+	if (view == NULL) {
+		return;
+	}
+	view_set_tags(view, (view->tags ^ arg->ui) & KWM_TAGMASK);
+}
+
+void kwm_focus_next(struct kwm_server *server, const arg *arg) {
+	struct kwm_output *output =
+		server->focused_view != NULL ? server->focused_view->output : output_at_cursor(server);
+	if (output == NULL) {
+		return;
+	}
+	output_focus_next(output);
+}
+
 bool handle_keybinding(struct kwm_server *server, uint32_t modifiers, xkb_keysym_t keysym) {
 	for (int i = 0; i < LENGTH(keybinds); i++) {
 		if (modifiers == keybinds[i].modifiers && keysym == keybinds[i].keysym) {
@@ -46,56 +87,57 @@ bool handle_keybinding(struct kwm_server *server, uint32_t modifiers, xkb_keysym
 	/* 		execl("/bin/sh", "/bin/sh", "-c", "/usr/bin/alacritty", (void *)NULL); */
 	/* 	} */
 	/* 	break; */
-	/* case XKB_KEY_F1: */
-	/* 	/1* Cycle to the next view *1/ */
-	/* 	/1* if (wl_list_length(&server->views) < 2) { *1/ */
-	/* 	/1* 	break; *1/ */
-	/* 	/1* } *1/ */
-	/* 	/1* struct tinywl_view *current_view = wl_container_of( *1/ */
-	/* 	/1* 	server->views.next, current_view, link); *1/ */
-	/* 	/1* struct tinywl_view *next_view = wl_container_of( *1/ */
-	/* 	/1* 	current_view->link.next, next_view, link); *1/ */
-	/* 	/1* focus_view(next_view, next_view->xdg_surface->surface); *1/ */
-	/* 	/1* /2* Move the previous view to the end of the list *2/ *1/ */
-	/* 	/1* wl_list_remove(&current_view->link); *1/ */
-	/* 	/1* wl_list_insert(server->views.prev, &current_view->link); *1/ */
-	/* 	break; */
 	/* default: */
 	/* 	return false; */
 	/* } */
 	/* return true; */
 
-bool init_workspaces(struct kwm_server *server) {
-	struct kwm_workspace *workspaces[9];
-	for (int i = 0; i <= 9; i++) {
-		/* server->workspaces[i] = calloc(1, sizeof(struct kwm_workspace)); */
-		/* wl_list_init(&server->workspaces[i]->views); */
-		// wlr_log(WLR_DEBUG, "Workspace %d Created: %p", i, &server->workspaces[i]);
+/* Returns the frame-rate cap of the first rule matching the app_id, 0 for no cap */
+int rule_max_fps(const char *app_id) {
+	for (int i = 0; i < LENGTH(rules); i++) {
+		if (strcmp(app_id, rules[i].app_id) == 0) {
+			return rules[i].max_fps;
+		}
 	}
-	/* /1* Initialize the list of workspaces. 10 in total *1/ */
-	/* wl_list_init(&server->workspaces); */
-	/* for (int i = 0; i <= 9; i++) { */
-	/* 	struct kwm_workspace *workspace = calloc(1, sizeof(struct kwm_workspace)); */
-	/* 	wl_list_init(&workspace->views); */
-	/* 	wl_list_insert(&server->workspaces, &workspace->link); */
-	/* } */
-	/* /1* Assign the workspaces to our outputs *1/ */
-	/* return true; */
+	return 0;
+}
+
+/* Returns the scale of the first rule matching the output name, 1 if none matches */
+float output_rule_scale(const char *name) {
+	for (int i = 0; i < LENGTH(output_rules); i++) {
+		if (strcmp(name, output_rules[i].name) == 0) {
+			return output_rules[i].scale;
+		}
+	}
+	return 1;
 }
 
 int main(int argc, char *argv[]) {
 	/* Set our log level */
 	wlr_log_init(WLR_DEBUG, NULL);
 
-	struct kwm_server server;
+	struct kwm_server server = {0};
 
-	init_workspaces(&server);
+	/* -t runs headless on a virtual clock, which a test driver advances through stdin */
+	int c;
+	while ((c = getopt(argc, argv, "t")) != -1) {
+		if (c == 't') {
+			server.clock.virtual = true;
+			setenv("WLR_BACKENDS", "headless", true);
+		} else {
+			fprintf(stderr, "usage: kwm [-t]\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 
 	if (!server_init(&server)) {
 		wlr_log(WLR_ERROR, "Failed to initialize the Wayland server");
 		exit(EXIT_FAILURE);
 	}
 	setenv("WAYLAND_DISPLAY", server.socket, true);
+	if (server.state.page != NULL) {
+		setenv("KWM_STATE", server.state.path, true);
+	}
 
 	if (!server_start(&server)) {
 		goto shutdown;
@@ -25,9 +25,37 @@ typedef struct {
 	const arg		arg;
 } keybind;
 
+typedef struct {
+	const char		*app_id;
+	int				max_fps;
+} rule;
+
+typedef struct {
+	const char		*name;
+	float			scale;
+} output_rule;
+
+extern const int xwayland_idle_timeout;
+extern const int idle_timeout;
+extern const int idle_dpms_timeout;
+extern const int event_loop_budget;
+extern const int worker_threads;
+extern const int texture_budget;
+extern const int software_rendering;
+extern const int watchdog_threshold;
+extern const char watchdog_log[];
+extern const int watchdog_log_size;
+
 bool handle_keybinding(struct kwm_server *server, uint32_t modifiers, xkb_keysym_t sym);
+int rule_max_fps(const char *app_id);
+float output_rule_scale(const char *name);
 void kwm_spawn_process(struct kwm_server *server, const arg *arg);
 void kwm_exit(struct kwm_server *server, const arg *arg);
 void kwm_kill_view(struct kwm_server *server, const arg *arg);
+void kwm_view_tags(struct kwm_server *server, const arg *arg);
+void kwm_toggle_view_tags(struct kwm_server *server, const arg *arg);
+void kwm_tag_view(struct kwm_server *server, const arg *arg);
+void kwm_toggle_tag_view(struct kwm_server *server, const arg *arg);
+void kwm_focus_next(struct kwm_server *server, const arg *arg);
 
 #endif
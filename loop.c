@@ -0,0 +1,176 @@
+#include "loop.h"
+#include "server.h"
+#include "kwm.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/backend/drm.h>
+#include <wlr/backend/libinput.h>
+#include <wlr/backend/multi.h>
+#include <wlr/backend/session.h>
+#include <wlr/util/log.h>
+
+/* Input events are considered late from this many milliseconds on */
+#define LATE_INPUT_MS 4
+/* Number of input events between two latency reports */
+#define LATENCY_REPORT_EVENTS 1000
+
+/* This function creates the backend. On a VT the libinput backend is created on a display of
+   its own, whose event loop only carries the input devices, so that input can be dispatched
+   ahead of everything else. When kwm runs nested, or WLR_BACKENDS picks the backends,
+   wlroots decides and input shares the main loop. */
+struct wlr_backend *loop_create_backend(struct kwm_loop *loop, struct wl_display *display) {
+	loop->display = display;
+	if (getenv("WAYLAND_DISPLAY") != NULL || getenv("WAYLAND_SOCKET") != NULL ||
+		getenv("DISPLAY") != NULL || getenv("WLR_BACKENDS") != NULL) {
+		return wlr_backend_autocreate(display, NULL);
+	}
+
+	/* The session is destroyed along with the main display */
+	struct wlr_session *session = wlr_session_create(display);
+	if (session == NULL) {
+		wlr_log(WLR_ERROR, "Failed to start a session");
+		return NULL;
+	}
+	struct wlr_backend *backend = wlr_multi_backend_create(display);
+	loop->input_display = wl_display_create();
+	if (backend == NULL || loop->input_display == NULL) {
+		return NULL;
+	}
+
+	struct wlr_backend *libinput = wlr_libinput_backend_create(loop->input_display, session);
+	if (libinput == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create the libinput backend");
+		return NULL;
+	}
+	wlr_multi_backend_add(backend, libinput);
+
+	int gpus[8];
+	size_t num_gpus = wlr_session_find_gpus(session, 8, gpus);
+	struct wlr_backend *primary = NULL;
+	for (size_t i = 0; i < num_gpus; i++) {
+		struct wlr_backend *drm = wlr_drm_backend_create(display, session, gpus[i], primary, NULL);
+		if (drm == NULL) {
+			wlr_log(WLR_ERROR, "Failed to open DRM device %d", gpus[i]);
+			continue;
+		}
+		if (primary == NULL) {
+			primary = drm;
+		}
+		wlr_multi_backend_add(backend, drm);
+	}
+	if (primary == NULL) {
+		wlr_log(WLR_ERROR, "Found no GPU to drive the outputs");
+		return NULL;
+	}
+	return backend;
+}
+
+/* Dispatches whatever the input devices have pending */
+static void loop_dispatch_input(struct kwm_loop *loop) {
+	if (loop->input_display != NULL) {
+		watchdog_phase(&loop->watchdog, "input");
+		wl_event_loop_dispatch(wl_display_get_event_loop(loop->input_display), 0);
+	}
+}
+
+/* Checks without blocking whether an fd has something to read */
+static bool fd_readable(int fd) {
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/* This function runs the main loop until loop_stop is called. Every iteration drains the
+   input devices first, then dispatches client requests, timers and output events for at
+   most event_loop_budget rounds, checking input again after each round, and finally
+   flushes all clients once. A round handles every source that was ready. libwayland
+   handles all requests of one read from a client socket together, so the budget bounds
+   rounds rather than requests, and a client flooding kwm with requests delays input by at
+   most one read of each client. The watchdog follows the phases of each iteration to report
+   stalls. */
+void loop_run(struct kwm_loop *loop) {
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(loop->display);
+	struct pollfd fds[2] = {
+		{.fd = wl_event_loop_get_fd(event_loop), .events = POLLIN},
+		{.fd = -1, .events = POLLIN},
+	};
+	if (loop->input_display != NULL) {
+		fds[1].fd = wl_event_loop_get_fd(wl_display_get_event_loop(loop->input_display));
+	}
+
+	loop->running = true;
+	watchdog_start(&loop->watchdog, loop->display);
+	while (loop->running) {
+		watchdog_wake(&loop->watchdog);
+		loop_dispatch_input(loop);
+		for (int i = 0; i < event_loop_budget && loop->running; i++) {
+			if (!fd_readable(fds[0].fd)) {
+				break;
+			}
+			watchdog_phase(&loop->watchdog, "dispatch");
+			wl_event_loop_dispatch(event_loop, 0);
+			loop_dispatch_input(loop);
+		}
+
+		/* Input handlers may have queued idle work, such as configure events */
+		watchdog_phase(&loop->watchdog, "idle");
+		wl_event_loop_dispatch_idle(event_loop);
+		watchdog_phase(&loop->watchdog, "flush");
+		wl_display_flush_clients(loop->display);
+		if (!loop->running) {
+			break;
+		}
+
+		/* When the budget ran out the main loop is still readable and this returns at once */
+		watchdog_phase(&loop->watchdog, NULL);
+		if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+			wlr_log_errno(WLR_ERROR, "Failed to wait for events");
+			break;
+		}
+	}
+	watchdog_stop(&loop->watchdog);
+}
+
+/* This function makes loop_run return after the current iteration */
+void loop_stop(struct kwm_loop *loop) {
+	loop->running = false;
+}
+
+/* This function frees the input display, once the backend was destroyed with the main one */
+void loop_finish(struct kwm_loop *loop) {
+	if (loop->input_display != NULL) {
+		wl_display_destroy(loop->input_display);
+		loop->input_display = NULL;
+	}
+}
+
+/* This function is called by the input handlers with the timestamp of the event. The time
+   between the device reporting the event and kwm handling it is reported regularly */
+void loop_record_input(struct kwm_loop *loop, uint32_t time_msec) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint32_t now_msec = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	uint32_t latency = now_msec - time_msec;
+	if (latency > 60000) {
+		/* Timestamps from another clock, such as those of a parent compositor */
+		return;
+	}
+
+	loop->latency_count++;
+	loop->latency_sum += latency;
+	if (latency > loop->latency_max) {
+		loop->latency_max = latency;
+	}
+	if (latency >= LATE_INPUT_MS) {
+		loop->latency_late++;
+	}
+
+	if (loop->latency_count == LATENCY_REPORT_EVENTS) {
+		wlr_log(WLR_INFO, "Input latency over %u events: avg %.2f ms, max %u ms, %u >= %d ms",
+				loop->latency_count, (double)loop->latency_sum / loop->latency_count,
+				loop->latency_max, loop->latency_late, LATE_INPUT_MS);
+		loop->latency_count = loop->latency_max = loop->latency_late = 0;
+		loop->latency_sum = 0;
+	}
+}
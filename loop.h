@@ -0,0 +1,32 @@
+#ifndef KWM_LOOP_H
+#define KWM_LOOP_H
+
+#include "watchdog.h"
+#include <stdint.h>
+#include <wayland-server.h>
+#include <wlr/backend.h>
+
+/* This struct holds the state of the main loop. kwm runs the loop itself instead of
+   wl_display_run, so that input is dispatched ahead of client requests */
+struct kwm_loop {
+	struct wl_display *display;
+	/* Display whose event loop only carries the input devices. It is NULL when input comes
+	   through the main loop, for instance when kwm runs nested */
+	struct wl_display *input_display;
+	bool running;
+	struct kwm_watchdog watchdog;
+
+	/* Input-to-dispatch latency in milliseconds, since the last report */
+	uint32_t latency_count;
+	uint64_t latency_sum;
+	uint32_t latency_max;
+	uint32_t latency_late;
+};
+
+struct wlr_backend *loop_create_backend(struct kwm_loop *loop, struct wl_display *display);
+void loop_run(struct kwm_loop *loop);
+void loop_stop(struct kwm_loop *loop);
+void loop_finish(struct kwm_loop *loop);
+void loop_record_input(struct kwm_loop *loop, uint32_t time_msec);
+
+#endif
@@ -0,0 +1,190 @@
+#include "pool.h"
+#include "server.h"
+#include "kwm.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+/* Returns the time elapsed between two timestamps in microseconds */
+static long timespec_diff_us(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* Worker threads run the pending tasks in the order they were submitted */
+static void *pool_worker(void *data) {
+	struct kwm_pool *pool = data;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->stopping && wl_list_empty(&pool->pending)) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		struct kwm_task *task = wl_container_of(pool->pending.next, task, link);
+		wl_list_remove(&task->link);
+		pthread_mutex_unlock(&pool->lock);
+
+		clock_gettime(CLOCK_MONOTONIC, &task->started);
+		task->run(task);
+		clock_gettime(CLOCK_MONOTONIC, &task->finished);
+
+		pthread_mutex_lock(&pool->lock);
+		wl_list_insert(pool->finished.prev, &task->link);
+		uint64_t one = 1;
+		if (write(pool->event_fd, &one, sizeof(one)) < 0) {
+			wlr_log_errno(WLR_ERROR, "Failed to wake up the main thread");
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* Accounts for a finished task and lets its owner apply the result */
+static void pool_complete(struct kwm_pool *pool, struct kwm_task *task) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long wait = timespec_diff_us(&task->submitted, &task->started);
+	long run = timespec_diff_us(&task->started, &task->finished);
+	long latency = timespec_diff_us(&task->submitted, &now);
+
+	pool->depth--;
+	pool->completed++;
+	pool->wait_us_sum += wait;
+	pool->run_us_sum += run;
+	if ((uint64_t)latency > pool->latency_us_max) {
+		pool->latency_us_max = latency;
+	}
+	wlr_log(WLR_DEBUG, "Task %s waited %ld us, ran %ld us, was applied after %ld us, %d queued",
+			task->name, wait, run, latency, pool->depth);
+	task->done(task);
+}
+
+/* This function is called on the main thread when workers finished tasks */
+static int handle_pool_event(int fd, uint32_t mask, void *data) {
+	struct kwm_pool *pool = data;
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "Failed to read the pool eventfd");
+	}
+
+	struct wl_list finished;
+	wl_list_init(&finished);
+	pthread_mutex_lock(&pool->lock);
+	wl_list_insert_list(&finished, &pool->finished);
+	wl_list_init(&pool->finished);
+	pthread_mutex_unlock(&pool->lock);
+
+	struct kwm_task *task, *tmp;
+	wl_list_for_each_safe(task, tmp, &finished, link) {
+		wl_list_remove(&task->link);
+		pool_complete(pool, task);
+	}
+	return 0;
+}
+
+/* This function starts worker_threads workers. Without workers, tasks run when submitted */
+bool pool_init(struct kwm_pool *pool, struct wl_display *display) {
+	wl_list_init(&pool->pending);
+	wl_list_init(&pool->finished);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	pool->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pool->event_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create the pool eventfd");
+		return false;
+	}
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	pool->source =
+		wl_event_loop_add_fd(loop, pool->event_fd, WL_EVENT_READABLE, handle_pool_event, pool);
+	if (pool->source == NULL) {
+		return false;
+	}
+
+	/* Signals are left to the main thread */
+	sigset_t all, previous;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &previous);
+	int wanted = worker_threads < POOL_MAX_THREADS ? worker_threads : POOL_MAX_THREADS;
+	for (int i = 0; i < wanted; i++) {
+		int ret = pthread_create(&pool->threads[i], NULL, pool_worker, pool);
+		if (ret != 0) {
+			wlr_log(WLR_ERROR, "Failed to start a worker thread: %s", strerror(ret));
+			break;
+		}
+		pool->num_threads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	return true;
+}
+
+/* This function stops the workers. Tasks which did not complete are cancelled */
+void pool_finish(struct kwm_pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pool->num_threads = 0;
+
+	wl_list_insert_list(&pool->pending, &pool->finished);
+	wl_list_init(&pool->finished);
+	struct kwm_task *task, *tmp;
+	wl_list_for_each_safe(task, tmp, &pool->pending, link) {
+		wl_list_remove(&task->link);
+		task->cancelled = true;
+		task->done(task);
+	}
+
+	if (pool->source != NULL) {
+		wl_event_source_remove(pool->source);
+		pool->source = NULL;
+	}
+	if (pool->event_fd >= 0) {
+		close(pool->event_fd);
+		pool->event_fd = -1;
+	}
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/* Queues a task for the workers. Its done callback runs on the main thread once a worker ran
+   it, or right away when there are no workers */
+void pool_submit(struct kwm_pool *pool, struct kwm_task *task) {
+	task->cancelled = false;
+	clock_gettime(CLOCK_MONOTONIC, &task->submitted);
+	pool->depth++;
+	if (pool->depth > pool->max_depth) {
+		pool->max_depth = pool->depth;
+	}
+
+	if (pool->num_threads == 0) {
+		task->started = task->submitted;
+		task->run(task);
+		clock_gettime(CLOCK_MONOTONIC, &task->finished);
+		pool_complete(pool, task);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	wl_list_insert(pool->pending.prev, &task->link);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Logs how busy the pool is */
+void pool_dump_stats(struct kwm_pool *pool) {
+	uint64_t completed = pool->completed > 0 ? pool->completed : 1;
+	wlr_log(WLR_INFO,
+			"Worker pool: %d threads, %" PRIu64 " tasks, %d queued (max %d), avg wait %" PRIu64
+			" us, avg run %" PRIu64 " us, max latency %" PRIu64 " us",
+			pool->num_threads, pool->completed, pool->depth, pool->max_depth,
+			pool->wait_us_sum / completed, pool->run_us_sum / completed, pool->latency_us_max);
+}
@@ -0,0 +1,54 @@
+#ifndef KWM_POOL_H
+#define KWM_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define POOL_MAX_THREADS 8
+
+/* A unit of work for the pool. The caller embeds it in the state of the task. run is called
+   on a worker thread and must not touch compositor state, done is then called on the main
+   thread to apply the result. done is called exactly once, with cancelled set when the pool
+   shuts down, in which case it only frees the task */
+struct kwm_task {
+	const char *name;
+	void (*run)(struct kwm_task *task);
+	void (*done)(struct kwm_task *task);
+	bool cancelled;
+
+	struct timespec submitted, started, finished;
+	struct wl_list link;
+};
+
+/* This struct holds the worker threads. Finished tasks are queued for the main thread,
+   which is woken up through an eventfd in the event loop */
+struct kwm_pool {
+	pthread_t threads[POOL_MAX_THREADS];
+	int num_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stopping;
+
+	/* Both protected by the lock */
+	struct wl_list pending;
+	struct wl_list finished;
+
+	int event_fd;
+	struct wl_event_source *source;
+
+	/* Instrumentation, kept by the main thread */
+	int depth;
+	int max_depth;
+	uint64_t completed;
+	uint64_t wait_us_sum, run_us_sum, latency_us_max;
+};
+
+bool pool_init(struct kwm_pool *pool, struct wl_display *display);
+void pool_finish(struct kwm_pool *pool);
+void pool_submit(struct kwm_pool *pool, struct kwm_task *task);
+void pool_dump_stats(struct kwm_pool *pool);
+
+#endif
@@ -0,0 +1,182 @@
+#include "raster.h"
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/log.h>
+
+/* Converts a renderer color, which is premultiplied, into a pixel */
+static uint32_t raster_pixel(const float color[4]) {
+	return (uint32_t)(color[3] * 255 + 0.5) << 24 | (uint32_t)(color[0] * 255 + 0.5) << 16 |
+		   (uint32_t)(color[1] * 255 + 0.5) << 8 | (uint32_t)(color[2] * 255 + 0.5);
+}
+
+/* Makes sure the framebuffer and its texture have the size of the output. A new framebuffer
+   is not valid until it was drawn as a whole */
+bool raster_begin(struct kwm_raster *raster, struct wlr_renderer *renderer, int width,
+				  int height) {
+	if (raster->image != NULL && pixman_image_get_width(raster->image) == width &&
+		pixman_image_get_height(raster->image) == height) {
+		return true;
+	}
+	raster_finish(raster);
+	raster->image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height, NULL, width * 4);
+	if (raster->image == NULL) {
+		return false;
+	}
+	raster->texture = wlr_texture_from_pixels(renderer, WL_SHM_FORMAT_XRGB8888, width * 4,
+											  width, height, pixman_image_get_data(raster->image));
+	if (raster->texture == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create the texture of a software framebuffer");
+		raster_finish(raster);
+		return false;
+	}
+	return true;
+}
+
+void raster_finish(struct kwm_raster *raster) {
+	if (raster->texture != NULL) {
+		wlr_texture_destroy(raster->texture);
+		raster->texture = NULL;
+	}
+	if (raster->image != NULL) {
+		pixman_image_unref(raster->image);
+		raster->image = NULL;
+	}
+	raster->valid = false;
+}
+
+/* Fills a box of the framebuffer. Opaque colors are written without reading the framebuffer */
+void raster_fill(struct kwm_raster *raster, pixman_box32_t *box, const float color[4]) {
+	int width = box->x2 - box->x1, height = box->y2 - box->y1;
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+	uint32_t *data = pixman_image_get_data(raster->image);
+	int stride = pixman_image_get_stride(raster->image) / 4;
+	if (color[3] >= 1 &&
+		pixman_fill(data, stride, 32, box->x1, box->y1, width, height, raster_pixel(color))) {
+		return;
+	}
+
+	pixman_color_t solid = {
+		.red = color[0] * 0xffff,
+		.green = color[1] * 0xffff,
+		.blue = color[2] * 0xffff,
+		.alpha = color[3] * 0xffff,
+	};
+	pixman_image_t *src = pixman_image_create_solid_fill(&solid);
+	if (src == NULL) {
+		return;
+	}
+	pixman_image_composite32(PIXMAN_OP_OVER, src, NULL, raster->image, 0, 0, 0, 0, box->x1,
+							 box->y1, width, height);
+	pixman_image_unref(src);
+}
+
+/* Copies an unscaled image into a box of the framebuffer, src_x and src_y being the image
+   pixel at the top left corner of the box. Opaque images are copied row by row, the others
+   are blended */
+void raster_blit(struct kwm_raster *raster, pixman_box32_t *box, pixman_image_t *src, int src_x,
+				 int src_y, bool opaque) {
+	int width = box->x2 - box->x1, height = box->y2 - box->y1;
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+	if (opaque && pixman_blt(pixman_image_get_data(src), pixman_image_get_data(raster->image),
+							 pixman_image_get_stride(src) / 4,
+							 pixman_image_get_stride(raster->image) / 4, 32, 32, src_x, src_y,
+							 box->x1, box->y1, width, height)) {
+		return;
+	}
+	pixman_image_composite32(opaque ? PIXMAN_OP_SRC : PIXMAN_OP_OVER, src, NULL, raster->image,
+							 src_x, src_y, 0, 0, box->x1, box->y1, width, height);
+}
+
+/* Draws part of an image scaled into a box of the framebuffer. The source box of the image
+   is stretched over dst, which is in framebuffer coordinates, and filtered bilinearly */
+void raster_blit_scaled(struct kwm_raster *raster, pixman_box32_t *box, pixman_image_t *src,
+						const struct wlr_fbox *src_box, const struct wlr_box *dst, bool opaque) {
+	int width = box->x2 - box->x1, height = box->y2 - box->y1;
+	if (width <= 0 || height <= 0 || dst->width <= 0 || dst->height <= 0) {
+		return;
+	}
+	/* The transform maps framebuffer pixels, relative to dst, to pixels of the image */
+	pixman_transform_t transform = {{
+		{pixman_double_to_fixed(src_box->width / dst->width), 0,
+		 pixman_double_to_fixed(src_box->x)},
+		{0, pixman_double_to_fixed(src_box->height / dst->height),
+		 pixman_double_to_fixed(src_box->y)},
+		{0, 0, pixman_fixed_1},
+	}};
+	pixman_image_set_transform(src, &transform);
+	pixman_image_set_filter(src, PIXMAN_FILTER_BILINEAR, NULL, 0);
+	pixman_image_set_repeat(src, PIXMAN_REPEAT_PAD);
+	pixman_image_composite32(opaque ? PIXMAN_OP_SRC : PIXMAN_OP_OVER, src, NULL, raster->image,
+							 box->x1 - dst->x, box->y1 - dst->y, 0, 0, box->x1, box->y1, width,
+							 height);
+	pixman_image_set_transform(src, NULL);
+	pixman_image_set_filter(src, PIXMAN_FILTER_NEAREST, NULL, 0);
+	pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
+}
+
+/* Uploads the damaged part of the framebuffer into its texture */
+bool raster_upload(struct kwm_raster *raster, pixman_region32_t *damage) {
+	uint32_t *data = pixman_image_get_data(raster->image);
+	int stride = pixman_image_get_stride(raster->image);
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		if (!wlr_texture_write_pixels(raster->texture, stride, rects[i].x2 - rects[i].x1,
+									  rects[i].y2 - rects[i].y1, rects[i].x1, rects[i].y1,
+									  rects[i].x1, rects[i].y1, data)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Keeps a copy of a shared memory buffer for the software renderer. Only the damaged part is
+   copied, unless the size changed. Returns NULL for formats pixman cannot blit */
+pixman_image_t *raster_copy_buffer(pixman_image_t *copy, struct wl_shm_buffer *buffer,
+								   pixman_region32_t *damage) {
+	uint32_t format = wl_shm_buffer_get_format(buffer);
+	int width = wl_shm_buffer_get_width(buffer);
+	int height = wl_shm_buffer_get_height(buffer);
+	int stride = wl_shm_buffer_get_stride(buffer);
+	if ((format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) || stride % 4) {
+		if (copy != NULL) {
+			pixman_image_unref(copy);
+		}
+		return NULL;
+	}
+
+	pixman_region32_t region;
+	pixman_region32_init(&region);
+	if (copy == NULL || pixman_image_get_width(copy) != width ||
+		pixman_image_get_height(copy) != height) {
+		if (copy != NULL) {
+			pixman_image_unref(copy);
+		}
+		copy = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height, NULL, width * 4);
+		if (copy == NULL) {
+			pixman_region32_fini(&region);
+			return NULL;
+		}
+		pixman_region32_union_rect(&region, &region, 0, 0, width, height);
+	} else {
+		pixman_region32_intersect_rect(&region, damage, 0, 0, width, height);
+	}
+
+	/* The alpha channel of XRGB buffers is undefined, the copy is then always blitted as
+	   opaque so it is never read */
+	wl_shm_buffer_begin_access(buffer);
+	uint32_t *data = wl_shm_buffer_get_data(buffer);
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		pixman_blt(data, pixman_image_get_data(copy), stride / 4,
+				   pixman_image_get_stride(copy) / 4, 32, 32, rects[i].x1, rects[i].y1,
+				   rects[i].x1, rects[i].y1, rects[i].x2 - rects[i].x1, rects[i].y2 - rects[i].y1);
+	}
+	wl_shm_buffer_end_access(buffer);
+	pixman_region32_fini(&region);
+	return copy;
+}
@@ -0,0 +1,33 @@
+#ifndef KWM_RASTER_H
+#define KWM_RASTER_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <wayland-server.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_box.h>
+
+/* The software framebuffer of an output. The scene is drawn into it with pixman, whose fills
+   and copies are vectorized, and its damage is uploaded into a texture which the renderer
+   only has to show one to one */
+struct kwm_raster {
+	pixman_image_t *image;
+	struct wlr_texture *texture;
+	/* Cleared when the renderer drew a frame in place of the framebuffer, which is then
+	   redrawn as a whole */
+	bool valid;
+};
+
+bool raster_begin(struct kwm_raster *raster, struct wlr_renderer *renderer, int width,
+				  int height);
+void raster_finish(struct kwm_raster *raster);
+void raster_fill(struct kwm_raster *raster, pixman_box32_t *box, const float color[4]);
+void raster_blit(struct kwm_raster *raster, pixman_box32_t *box, pixman_image_t *src, int src_x,
+				 int src_y, bool opaque);
+void raster_blit_scaled(struct kwm_raster *raster, pixman_box32_t *box, pixman_image_t *src,
+						const struct wlr_fbox *src_box, const struct wlr_box *dst, bool opaque);
+bool raster_upload(struct kwm_raster *raster, pixman_region32_t *damage);
+pixman_image_t *raster_copy_buffer(pixman_image_t *copy, struct wl_shm_buffer *buffer,
+								   pixman_region32_t *damage);
+
+#endif
@@ -0,0 +1,1137 @@
+#include "scene.h"
+#include "hidpi.h"
+#include "server.h"
+#include "kwm.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output_damage.h>
+#include <wlr/util/log.h>
+#include <wlr/util/region.h>
+
+/* This helper keeps track of an xdg surface and its popups in the scene */
+struct kwm_scene_xdg_surface {
+	struct kwm_scene_node *tree;
+	struct wlr_xdg_surface *xdg_surface;
+
+	struct wl_listener tree_destroy;
+	struct wl_listener xdg_destroy;
+	struct wl_listener map;
+	struct wl_listener unmap;
+	struct wl_listener commit;
+	struct wl_listener new_popup;
+};
+
+static const float background_color[4] = {0.3, 0.3, 0.3, 1.0};
+
+static void scene_node_init(struct kwm_scene_node *node, enum kwm_scene_node_type type,
+							struct kwm_scene_node *parent) {
+	node->type = type;
+	node->parent = parent;
+	node->enabled = true;
+	wl_list_init(&node->children);
+	wl_signal_init(&node->events.destroy);
+	if (parent != NULL) {
+		wl_list_insert(parent->children.prev, &node->link);
+	} else {
+		wl_list_init(&node->link);
+	}
+}
+
+static struct kwm_scene *scene_from_node(struct kwm_scene_node *node) {
+	while (node->parent != NULL) {
+		node = node->parent;
+	}
+	struct kwm_scene *scene = wl_container_of(node, scene, tree);
+	return scene;
+}
+
+/* Checks whether a node with the given tags is hidden on an output showing output_tags.
+   Untagged nodes are always shown */
+static bool tags_hidden(uint32_t tags, uint32_t output_tags) {
+	return tags != 0 && (tags & output_tags) == 0;
+}
+
+/* Returns the output a node is shown on, or NULL if the node or one of its parents is
+   disabled or tagged with none of the tags the output shows */
+static struct kwm_output *scene_node_shown_output(struct kwm_scene_node *node) {
+	struct kwm_output *output = NULL;
+	uint32_t tags = 0;
+	for (; node != NULL; node = node->parent) {
+		if (!node->enabled) {
+			return NULL;
+		}
+		tags |= node->tags;
+		if (node->type == KWM_SCENE_OUTPUT) {
+			struct kwm_scene_output *scene_output = wl_container_of(node, scene_output, node);
+			output = scene_output->output;
+		}
+	}
+	if (output != NULL && tags_hidden(tags, output->tags)) {
+		return NULL;
+	}
+	return output;
+}
+
+bool scene_node_visible(struct kwm_scene_node *node) {
+	return scene_node_shown_output(node) != NULL;
+}
+
+/* Sums up the positions of a node and its parents into layout coordinates */
+void scene_node_coords(struct kwm_scene_node *node, int *lx, int *ly) {
+	*lx = 0, *ly = 0;
+	for (; node != NULL; node = node->parent) {
+		*lx += node->x;
+		*ly += node->y;
+	}
+}
+
+/* Damage is tracked in output buffer coordinates, so boxes in layout coordinates are moved
+   to the output and scaled */
+static void output_damage_box(struct kwm_scene *scene, struct kwm_output *output,
+							  struct wlr_box *box) {
+	struct wlr_box *output_box = wlr_output_layout_get_box(scene->layout, output->wlr_output);
+	if (output_box == NULL) {
+		return;
+	}
+	float scale = output->wlr_output->scale;
+	int x = box->x - output_box->x, y = box->y - output_box->y;
+	struct wlr_box damage = {
+		.x = round(x * scale),
+		.y = round(y * scale),
+		.width = round((x + box->width) * scale) - round(x * scale),
+		.height = round((y + box->height) * scale) - round(y * scale),
+	};
+	wlr_output_damage_add_box(output->damage, &damage);
+}
+
+static void output_damage_region(struct kwm_scene *scene, struct kwm_output *output,
+								 pixman_region32_t *region) {
+	struct wlr_box *output_box = wlr_output_layout_get_box(scene->layout, output->wlr_output);
+	if (output_box == NULL) {
+		return;
+	}
+	pixman_region32_translate(region, -output_box->x, -output_box->y);
+	wlr_region_scale(region, region, output->wlr_output->scale);
+	wlr_output_damage_add(output->damage, region);
+}
+
+static void scene_node_damage_at(struct kwm_scene *scene, struct kwm_output *output,
+								 struct kwm_scene_node *node, int lx, int ly) {
+	if (!node->enabled) {
+		return;
+	}
+	lx += node->x, ly += node->y;
+	if (node->type == KWM_SCENE_RECT || node->type == KWM_SCENE_SURFACE) {
+		struct wlr_box box = {.x = lx, .y = ly, .width = node->width, .height = node->height};
+		output_damage_box(scene, output, &box);
+	}
+	struct kwm_scene_node *child;
+	wl_list_for_each(child, &node->children, link) {
+		scene_node_damage_at(scene, output, child, lx, ly);
+	}
+}
+
+/* Damages everything a node and its children cover on screen */
+void scene_node_damage(struct kwm_scene_node *node) {
+	struct kwm_output *output = scene_node_shown_output(node);
+	if (output == NULL) {
+		return;
+	}
+	int lx = 0, ly = 0;
+	scene_node_coords(node->parent, &lx, &ly);
+	scene_node_damage_at(scene_from_node(node), output, node, lx, ly);
+}
+
+struct kwm_scene *scene_create(struct wlr_output_layout *layout, struct wlr_renderer *renderer) {
+	struct kwm_scene *scene = calloc(1, sizeof(struct kwm_scene));
+	if (scene == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene->tree, KWM_SCENE_TREE, NULL);
+	scene->layout = layout;
+	scene->renderer = renderer;
+	scene->software_rendering = software_rendering;
+	wl_list_init(&scene->frame_pending);
+	wl_list_init(&scene->surfaces);
+	wl_list_init(&scene->hidden);
+	return scene;
+}
+
+struct kwm_scene_node *scene_tree_create(struct kwm_scene_node *parent) {
+	struct kwm_scene_node *node = calloc(1, sizeof(struct kwm_scene_node));
+	if (node == NULL) {
+		return NULL;
+	}
+	scene_node_init(node, KWM_SCENE_TREE, parent);
+	return node;
+}
+
+struct kwm_scene_node *scene_output_create(struct kwm_scene *scene, struct kwm_output *output) {
+	struct kwm_scene_output *scene_output = calloc(1, sizeof(struct kwm_scene_output));
+	if (scene_output == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene_output->node, KWM_SCENE_OUTPUT, &scene->tree);
+	scene_output->output = output;
+	return &scene_output->node;
+}
+
+struct kwm_scene_rect *scene_rect_create(struct kwm_scene_node *parent, int width, int height,
+										 const float color[4]) {
+	struct kwm_scene_rect *rect = calloc(1, sizeof(struct kwm_scene_rect));
+	if (rect == NULL) {
+		return NULL;
+	}
+	scene_node_init(&rect->node, KWM_SCENE_RECT, parent);
+	memcpy(rect->color, color, sizeof(rect->color));
+	scene_node_set_size(&rect->node, width, height);
+	return rect;
+}
+
+static void scene_subsurface_create(struct kwm_scene_node *parent,
+									struct wlr_subsurface *subsurface);
+
+/* Returns the memory taken by a texture, assuming four bytes per pixel */
+static size_t texture_bytes(struct wlr_texture *texture) {
+	if (texture == NULL) {
+		return 0;
+	}
+	int width, height;
+	wlr_texture_get_size(texture, &width, &height);
+	return (size_t)width * height * 4;
+}
+
+/* Sums up the memory the surfaces in a tree take, such as the ones of a view */
+size_t scene_node_texture_bytes(struct kwm_scene_node *node) {
+	size_t bytes = 0;
+	if (node->type == KWM_SCENE_SURFACE) {
+		struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+		bytes += scene_surface->texture_bytes;
+	}
+	struct kwm_scene_node *child;
+	wl_list_for_each(child, &node->children, link) { bytes += scene_node_texture_bytes(child); }
+	return bytes;
+}
+
+/* Returns the texture a surface is drawn with. That is the one wlroots uploaded, unless it
+   was evicted: kwm then draws from its own upload of the copy of the buffer, which only
+   exists while the surface is shown */
+static struct wlr_texture *scene_surface_get_texture(struct kwm_scene_surface *scene_surface) {
+	if (scene_surface->evicted) {
+		return scene_surface->texture;
+	}
+	return wlr_surface_get_texture(scene_surface->surface);
+}
+
+/* Accounts the memory a surface takes: its copy of the buffer and its texture */
+static void scene_surface_account(struct kwm_scene_surface *scene_surface) {
+	size_t bytes = texture_bytes(scene_surface_get_texture(scene_surface));
+	if (scene_surface->pixels != NULL) {
+		bytes += (size_t)pixman_image_get_stride(scene_surface->pixels) *
+			pixman_image_get_height(scene_surface->pixels);
+	}
+	scene_surface->scene->texture_bytes -= scene_surface->texture_bytes;
+	scene_surface->scene->texture_bytes += bytes;
+	scene_surface->texture_bytes = bytes;
+}
+
+/* Keeps a hidden surface in the list of textures the budget can release, where it stays in
+   the order it was hidden in. Only a texture which can be uploaded again from the copy of
+   the buffer is released, and a single pixel is not worth it */
+static void scene_surface_update_hidden(struct kwm_scene_surface *scene_surface) {
+	bool evictable = scene_surface->output == NULL && scene_surface->pixels != NULL &&
+		texture_bytes(scene_surface_get_texture(scene_surface)) > 4;
+	if (!evictable) {
+		wl_list_remove(&scene_surface->hidden_link);
+		wl_list_init(&scene_surface->hidden_link);
+	} else if (wl_list_empty(&scene_surface->hidden_link)) {
+		wl_list_insert(scene_surface->scene->hidden.prev, &scene_surface->hidden_link);
+	}
+}
+
+/* Releases the texture kwm uploaded for a surface */
+static void scene_surface_drop_texture(struct kwm_scene_surface *scene_surface) {
+	if (scene_surface->texture != NULL) {
+		wlr_texture_destroy(scene_surface->texture);
+		scene_surface->texture = NULL;
+	}
+}
+
+/* Uploads the copy of the buffer of an evicted surface, which is drawn in place of the
+   texture of wlroots until the client commits a new buffer */
+static void scene_surface_upload(struct kwm_scene_surface *scene_surface) {
+	pixman_image_t *pixels = scene_surface->pixels;
+	scene_surface_drop_texture(scene_surface);
+	scene_surface->texture = wlr_texture_from_pixels(
+		scene_surface->scene->renderer, scene_surface->format, pixman_image_get_stride(pixels),
+		pixman_image_get_width(pixels), pixman_image_get_height(pixels),
+		pixman_image_get_data(pixels));
+}
+
+/* Follows the texture of a surface after a commit. A new buffer ends an eviction: wlroots
+   uploads it as a whole, since its size differs from the placeholder, and kwm's texture of
+   the previous buffer is dropped */
+static void scene_surface_update_texture(struct kwm_scene_surface *scene_surface) {
+	if (scene_surface->evicted) {
+		struct wlr_texture *texture = wlr_surface_get_texture(scene_surface->surface);
+		int width = 0, height = 0;
+		if (texture != NULL) {
+			wlr_texture_get_size(texture, &width, &height);
+		}
+		pixman_image_t *pixels = scene_surface->pixels;
+		if (pixels == NULL || width != 1 || height != 1 ||
+			(pixman_image_get_width(pixels) == 1 && pixman_image_get_height(pixels) == 1)) {
+			scene_surface->evicted = false;
+			scene_surface_drop_texture(scene_surface);
+		}
+	}
+	scene_surface_account(scene_surface);
+	scene_surface_update_hidden(scene_surface);
+}
+
+/* Releases the texture of a hidden surface. The copy of its buffer stays, so the texture can
+   be uploaded again when the surface is shown, without waiting for the client to redraw.
+   wlroots keeps the texture of the buffer for as long as the buffer is current, so it is
+   swapped for a single pixel, which kwm never draws */
+static void scene_surface_evict(struct kwm_scene_surface *scene_surface) {
+	static const uint32_t pixel = 0;
+	struct wlr_surface *surface = scene_surface->surface;
+	wlr_log(WLR_DEBUG, "Evicting texture of surface %p, %zu bytes", surface,
+			scene_surface->texture_bytes);
+	wl_list_remove(&scene_surface->hidden_link);
+	wl_list_init(&scene_surface->hidden_link);
+	if (scene_surface->evicted) {
+		scene_surface_drop_texture(scene_surface);
+	} else {
+		struct wlr_texture *placeholder = wlr_texture_from_pixels(
+			scene_surface->scene->renderer, WL_SHM_FORMAT_ARGB8888, 4, 1, 1, &pixel);
+		if (placeholder == NULL) {
+			return;
+		}
+		wlr_texture_destroy(surface->buffer->texture);
+		surface->buffer->texture = placeholder;
+		scene_surface->evicted = true;
+	}
+	scene_surface_account(scene_surface);
+}
+
+/* Evicts the textures of hidden surfaces, least recently shown first, until the copies and
+   textures of all surfaces fit into texture_budget */
+static void scene_enforce_texture_budget(struct kwm_scene *scene) {
+	size_t budget = (size_t)texture_budget << 20;
+	while (texture_budget > 0 && scene->texture_bytes > budget && !wl_list_empty(&scene->hidden)) {
+		struct kwm_scene_surface *victim =
+			wl_container_of(scene->hidden.next, victim, hidden_link);
+		scene_surface_evict(victim);
+	}
+}
+
+/* Tells the client of a surface which output it is shown on, so that it can render at the
+   right scale. Surfaces which are hidden leave their output */
+static void scene_surface_set_output(struct kwm_scene_surface *scene_surface,
+									 struct kwm_output *output) {
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wlr_output *wlr_output = output != NULL ? output->wlr_output : NULL;
+	if (scene_surface->output == wlr_output) {
+		return;
+	}
+	if (scene_surface->output != NULL) {
+		wlr_surface_send_leave(surface, scene_surface->output);
+	}
+	scene_surface->output = wlr_output;
+	/* A hidden texture is the first to go once it was hidden the longest */
+	scene_surface_update_hidden(scene_surface);
+	if (wlr_output == NULL) {
+		return;
+	}
+	wlr_surface_send_enter(surface, wlr_output);
+	surface_set_preferred_scale(surface, wlr_output->scale);
+
+	/* An evicted texture is uploaded again before the surface is drawn */
+	if (scene_surface->evicted && scene_surface->texture == NULL) {
+		scene_surface_upload(scene_surface);
+		scene_surface_account(scene_surface);
+		scene_enforce_texture_budget(scene_surface->scene);
+	}
+}
+
+static void scene_node_update_outputs_at(struct kwm_scene_node *node, struct kwm_output *output) {
+	if (node->type == KWM_SCENE_OUTPUT) {
+		struct kwm_scene_output *scene_output = wl_container_of(node, scene_output, node);
+		output = scene_output->output;
+	}
+	if (!node->enabled || (output != NULL && tags_hidden(node->tags, output->tags))) {
+		output = NULL;
+	}
+	if (node->type == KWM_SCENE_SURFACE) {
+		struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+		scene_surface_set_output(scene_surface, output);
+	}
+	struct kwm_scene_node *child;
+	wl_list_for_each(child, &node->children, link) {
+		scene_node_update_outputs_at(child, output);
+	}
+}
+
+/* Updates the output the surfaces of a tree are shown on, after the tree was shown, hidden,
+   retagged or moved to another output. This does not wait for the surfaces to be drawn, a
+   surface which is not damaged still learns where it is */
+void scene_node_update_outputs(struct kwm_scene_node *node) {
+	struct kwm_output *output = NULL;
+	if (node->parent != NULL) {
+		output = scene_node_shown_output(node->parent);
+	}
+	scene_node_update_outputs_at(node, output);
+}
+
+/* Returns the damage of the last commit in node coordinates. A viewport crops and scales
+   the buffer, so the buffer damage is mapped through it */
+static void scene_surface_get_damage(struct kwm_scene_surface *scene_surface,
+									 pixman_region32_t *damage) {
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wlr_fbox src;
+	if (!surface_get_source_box(surface, &src)) {
+		wlr_surface_get_effective_damage(surface, damage);
+		return;
+	}
+
+	struct kwm_scene_node *node = &scene_surface->node;
+	if (surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL || src.width <= 0 ||
+		src.height <= 0) {
+		pixman_region32_union_rect(damage, damage, 0, 0, node->width, node->height);
+		return;
+	}
+	double scale_x = node->width / src.width, scale_y = node->height / src.height;
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&surface->buffer_damage, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		int x1 = floor((rects[i].x1 - src.x) * scale_x);
+		int y1 = floor((rects[i].y1 - src.y) * scale_y);
+		int x2 = ceil((rects[i].x2 - src.x) * scale_x);
+		int y2 = ceil((rects[i].y2 - src.y) * scale_y);
+		pixman_region32_union_rect(damage, damage, x1, y1, x2 - x1, y2 - y1);
+	}
+	pixman_region32_intersect_rect(damage, damage, 0, 0, node->width, node->height);
+}
+
+/* Copies the buffer of a surface for the software renderer and for uploading evicted
+   textures again. The commit is handled before the client learns that wlroots released the
+   buffer, so it is safe to read from */
+static void scene_surface_update_pixels(struct kwm_scene_surface *scene_surface) {
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wl_shm_buffer *buffer = NULL;
+	if (surface->buffer != NULL && surface->buffer->resource != NULL) {
+		buffer = wl_shm_buffer_get(surface->buffer->resource);
+	} else if (surface->buffer != NULL && !pixman_region32_not_empty(&surface->buffer_damage)) {
+		/* The client destroyed the buffer it committed before, the copy is still current */
+		return;
+	}
+	if (buffer == NULL) {
+		if (scene_surface->pixels != NULL) {
+			pixman_image_unref(scene_surface->pixels);
+			scene_surface->pixels = NULL;
+		}
+		return;
+	}
+	uint32_t format = wl_shm_buffer_get_format(buffer);
+	scene_surface->format = format;
+	scene_surface->pixels =
+		raster_copy_buffer(scene_surface->pixels, buffer, &surface->buffer_damage);
+
+	int width, height;
+	surface_get_size(surface, &width, &height);
+	pixman_box32_t box = {0, 0, width, height};
+	scene_surface->opaque = format == WL_SHM_FORMAT_XRGB8888 ||
+		pixman_region32_contains_rectangle(&surface->opaque_region, &box) == PIXMAN_REGION_IN;
+}
+
+/* This function is called whenever a surface in the scene commits new state. Only the part
+   of the surface the client damaged is repainted, unless the surface changed its size */
+static void scene_surface_handle_commit(struct wl_listener *listener, void *data) {
+	struct kwm_scene_surface *scene_surface = wl_container_of(listener, scene_surface, commit);
+	struct kwm_scene_node *node = &scene_surface->node;
+	struct wlr_surface *surface = scene_surface->surface;
+
+	/* Subsurface positions are applied with the commit of their parent */
+	struct kwm_scene_node *child;
+	wl_list_for_each(child, &node->children, link) {
+		struct kwm_scene_surface *scene_child = wl_container_of(child, scene_child, node);
+		if (child->type == KWM_SCENE_SURFACE && scene_child->subsurface != NULL) {
+			scene_node_set_position(child, scene_child->subsurface->current.x,
+									scene_child->subsurface->current.y);
+		}
+	}
+
+	int surface_width, surface_height;
+	surface_get_size(surface, &surface_width, &surface_height);
+	int width = surface_width, height = surface_height;
+	if (scene_surface->dest_width > 0 && scene_surface->dest_height > 0) {
+		width = scene_surface->dest_width, height = scene_surface->dest_height;
+	}
+
+	struct kwm_output *output = scene_node_shown_output(node);
+	if (node->width != width || node->height != height) {
+		scene_node_set_size(node, width, height);
+	} else if (output != NULL && (width != surface_width || height != surface_height)) {
+		/* Damage of a stretched buffer does not map to the node, repaint all of it */
+		scene_node_damage(node);
+	} else if (output != NULL) {
+		int lx, ly;
+		scene_node_coords(node, &lx, &ly);
+		pixman_region32_t damage;
+		pixman_region32_init(&damage);
+		scene_surface_get_damage(scene_surface, &damage);
+		pixman_region32_translate(&damage, lx, ly);
+		output_damage_region(scene_surface->scene, output, &damage);
+		pixman_region32_fini(&damage);
+	}
+
+	/* Surfaces keep a copy of their buffer for the software renderer, and to upload textures
+	   evicted over the budget again */
+	if (scene_surface->scene->software_rendering || texture_budget > 0) {
+		scene_surface_update_pixels(scene_surface);
+	}
+	scene_surface_update_texture(scene_surface);
+	scene_enforce_texture_budget(scene_surface->scene);
+
+	/* Frame callbacks which came with this commit are answered on the next frame */
+	if (wl_list_empty(&scene_surface->frame_link)) {
+		wl_list_insert(scene_surface->scene->frame_pending.prev, &scene_surface->frame_link);
+	}
+	if (output != NULL) {
+		wlr_output_schedule_frame(output->wlr_output);
+	}
+}
+
+static void scene_surface_handle_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_scene_surface *scene_surface = wl_container_of(listener, scene_surface, destroy);
+	/* The surface is gone, there is nothing to leave */
+	scene_surface->output = NULL;
+	scene_node_destroy(&scene_surface->node);
+}
+
+/* Returns the node of a surface, NULL when it is not in the scene. The commit listener
+   links the surface to its node, the destroy one of a subsurface is on its role */
+static struct kwm_scene_surface *scene_surface_from_surface(struct wlr_surface *surface) {
+	struct wl_listener *listener =
+		wl_signal_get(&surface->events.commit, scene_surface_handle_commit);
+	if (listener == NULL) {
+		return NULL;
+	}
+	struct kwm_scene_surface *scene_surface = wl_container_of(listener, scene_surface, commit);
+	return scene_surface;
+}
+
+/* Returns the output a surface is shown on, NULL when it is hidden or not in the scene */
+struct wlr_output *scene_surface_get_output(struct wlr_surface *surface) {
+	struct kwm_scene_surface *scene_surface = scene_surface_from_surface(surface);
+	return scene_surface != NULL ? scene_surface->output : NULL;
+}
+
+/* Returns the memory a surface takes, as accounted against texture_budget */
+size_t scene_surface_texture_bytes(struct wlr_surface *surface) {
+	struct kwm_scene_surface *scene_surface = scene_surface_from_surface(surface);
+	return scene_surface != NULL ? scene_surface->texture_bytes : 0;
+}
+
+static void scene_surface_handle_new_subsurface(struct wl_listener *listener, void *data) {
+	struct kwm_scene_surface *scene_surface =
+		wl_container_of(listener, scene_surface, new_subsurface);
+	struct wlr_subsurface *subsurface = data;
+	scene_subsurface_create(&scene_surface->node, subsurface);
+}
+
+/* Creates a node for a surface and for each of its subsurfaces */
+struct kwm_scene_surface *scene_surface_create(struct kwm_scene_node *parent,
+											   struct wlr_surface *surface) {
+	struct kwm_scene_surface *scene_surface = calloc(1, sizeof(struct kwm_scene_surface));
+	if (scene_surface == NULL) {
+		return NULL;
+	}
+	scene_node_init(&scene_surface->node, KWM_SCENE_SURFACE, parent);
+	scene_surface->scene = scene_from_node(parent);
+	scene_surface->surface = surface;
+	wl_list_init(&scene_surface->frame_link);
+	wl_list_init(&scene_surface->hidden_link);
+	wl_list_insert(&scene_surface->scene->surfaces, &scene_surface->link);
+	scene_surface_account(scene_surface);
+	int width, height;
+	surface_get_size(surface, &width, &height);
+	scene_node_set_size(&scene_surface->node, width, height);
+
+	scene_surface->commit.notify = scene_surface_handle_commit;
+	wl_signal_add(&surface->events.commit, &scene_surface->commit);
+	scene_surface->destroy.notify = scene_surface_handle_destroy;
+	wl_signal_add(&surface->events.destroy, &scene_surface->destroy);
+	scene_surface->new_subsurface.notify = scene_surface_handle_new_subsurface;
+	wl_signal_add(&surface->events.new_subsurface, &scene_surface->new_subsurface);
+	scene_surface_set_output(scene_surface, scene_node_shown_output(&scene_surface->node));
+
+	struct wlr_subsurface *subsurface;
+	wl_list_for_each(subsurface, &surface->subsurfaces, parent_link) {
+		scene_subsurface_create(&scene_surface->node, subsurface);
+	}
+	return scene_surface;
+}
+
+/* Stretches the buffer of a surface to the given size, for instance while the client has
+   not caught up with a resize yet. A size of 0 shows the buffer at the surface size again */
+void scene_surface_set_dest_size(struct kwm_scene_surface *scene_surface, int width, int height) {
+	scene_surface->dest_width = width, scene_surface->dest_height = height;
+	if (width <= 0 || height <= 0) {
+		surface_get_size(scene_surface->surface, &width, &height);
+	}
+	scene_node_set_size(&scene_surface->node, width, height);
+}
+
+/* Subsurfaces are stacked above their parent and go away with their role, not their surface */
+static void scene_subsurface_create(struct kwm_scene_node *parent,
+									struct wlr_subsurface *subsurface) {
+	struct kwm_scene_surface *scene_surface = scene_surface_create(parent, subsurface->surface);
+	if (scene_surface == NULL) {
+		return;
+	}
+	scene_surface->subsurface = subsurface;
+	wl_list_remove(&scene_surface->destroy.link);
+	wl_signal_add(&subsurface->events.destroy, &scene_surface->destroy);
+	scene_node_set_position(&scene_surface->node, subsurface->current.x, subsurface->current.y);
+}
+
+static void scene_xdg_surface_handle_tree_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_scene_xdg_surface *scene_xdg = wl_container_of(listener, scene_xdg, tree_destroy);
+	wl_list_remove(&scene_xdg->tree_destroy.link);
+	wl_list_remove(&scene_xdg->xdg_destroy.link);
+	wl_list_remove(&scene_xdg->map.link);
+	wl_list_remove(&scene_xdg->unmap.link);
+	wl_list_remove(&scene_xdg->commit.link);
+	wl_list_remove(&scene_xdg->new_popup.link);
+	free(scene_xdg);
+}
+
+static void scene_xdg_surface_handle_xdg_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_scene_xdg_surface *scene_xdg = wl_container_of(listener, scene_xdg, xdg_destroy);
+	scene_node_destroy(scene_xdg->tree);
+}
+
+static void scene_xdg_surface_handle_map(struct wl_listener *listener, void *data) {
+	struct kwm_scene_xdg_surface *scene_xdg = wl_container_of(listener, scene_xdg, map);
+	scene_node_set_enabled(scene_xdg->tree, true);
+}
+
+static void scene_xdg_surface_handle_unmap(struct wl_listener *listener, void *data) {
+	struct kwm_scene_xdg_surface *scene_xdg = wl_container_of(listener, scene_xdg, unmap);
+	scene_node_set_enabled(scene_xdg->tree, false);
+}
+
+/* Popups are positioned relative to their parent, and may be moved by any commit */
+static void scene_xdg_surface_handle_commit(struct wl_listener *listener, void *data) {
+	struct kwm_scene_xdg_surface *scene_xdg = wl_container_of(listener, scene_xdg, commit);
+	if (scene_xdg->xdg_surface->role != WLR_XDG_SURFACE_ROLE_POPUP) {
+		return;
+	}
+	double sx, sy;
+	wlr_xdg_popup_get_position(scene_xdg->xdg_surface->popup, &sx, &sy);
+	scene_node_set_position(scene_xdg->tree, sx, sy);
+}
+
+static void scene_xdg_surface_handle_new_popup(struct wl_listener *listener, void *data) {
+	struct kwm_scene_xdg_surface *scene_xdg = wl_container_of(listener, scene_xdg, new_popup);
+	struct wlr_xdg_popup *popup = data;
+	scene_xdg_surface_create(scene_xdg->tree, popup->base);
+}
+
+/* Creates a tree holding the surfaces of an xdg surface and its popups */
+struct kwm_scene_node *scene_xdg_surface_create(struct kwm_scene_node *parent,
+												struct wlr_xdg_surface *xdg_surface) {
+	struct kwm_scene_xdg_surface *scene_xdg = calloc(1, sizeof(struct kwm_scene_xdg_surface));
+	if (scene_xdg == NULL) {
+		return NULL;
+	}
+	scene_xdg->tree = scene_tree_create(parent);
+	if (scene_xdg->tree == NULL) {
+		free(scene_xdg);
+		return NULL;
+	}
+	scene_xdg->xdg_surface = xdg_surface;
+	scene_xdg->tree->enabled = xdg_surface->mapped;
+	scene_surface_create(scene_xdg->tree, xdg_surface->surface);
+
+	scene_xdg->tree_destroy.notify = scene_xdg_surface_handle_tree_destroy;
+	wl_signal_add(&scene_xdg->tree->events.destroy, &scene_xdg->tree_destroy);
+	scene_xdg->xdg_destroy.notify = scene_xdg_surface_handle_xdg_destroy;
+	wl_signal_add(&xdg_surface->events.destroy, &scene_xdg->xdg_destroy);
+	scene_xdg->map.notify = scene_xdg_surface_handle_map;
+	wl_signal_add(&xdg_surface->events.map, &scene_xdg->map);
+	scene_xdg->unmap.notify = scene_xdg_surface_handle_unmap;
+	wl_signal_add(&xdg_surface->events.unmap, &scene_xdg->unmap);
+	scene_xdg->commit.notify = scene_xdg_surface_handle_commit;
+	wl_signal_add(&xdg_surface->surface->events.commit, &scene_xdg->commit);
+	scene_xdg->new_popup.notify = scene_xdg_surface_handle_new_popup;
+	wl_signal_add(&xdg_surface->events.new_popup, &scene_xdg->new_popup);
+
+	return scene_xdg->tree;
+}
+
+/* Returns the node of the main surface of a tree made by scene_xdg_surface_create */
+struct kwm_scene_surface *scene_xdg_surface_get_surface(struct kwm_scene_node *tree) {
+	struct kwm_scene_node *node;
+	wl_list_for_each(node, &tree->children, link) {
+		if (node->type == KWM_SCENE_SURFACE) {
+			struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+			return scene_surface;
+		}
+	}
+	return NULL;
+}
+
+/* Releases a node and its children without damaging them */
+static void scene_node_finish(struct kwm_scene_node *node) {
+	wl_signal_emit(&node->events.destroy, node);
+
+	struct kwm_scene_node *child, *tmp;
+	wl_list_for_each_safe(child, tmp, &node->children, link) { scene_node_finish(child); }
+	wl_list_remove(&node->link);
+
+	if (node->type == KWM_SCENE_SURFACE) {
+		struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+		scene_surface_set_output(scene_surface, NULL);
+		scene_surface_drop_texture(scene_surface);
+		wl_list_remove(&scene_surface->hidden_link);
+		scene_surface->scene->texture_bytes -= scene_surface->texture_bytes;
+		wl_list_remove(&scene_surface->link);
+		wl_list_remove(&scene_surface->frame_link);
+		wl_list_remove(&scene_surface->commit.link);
+		wl_list_remove(&scene_surface->destroy.link);
+		wl_list_remove(&scene_surface->new_subsurface.link);
+		if (scene_surface->pixels != NULL) {
+			pixman_image_unref(scene_surface->pixels);
+		}
+		free(scene_surface);
+	} else if (node->type == KWM_SCENE_RECT) {
+		struct kwm_scene_rect *rect = wl_container_of(node, rect, node);
+		free(rect);
+	} else if (node->type == KWM_SCENE_OUTPUT) {
+		struct kwm_scene_output *scene_output = wl_container_of(node, scene_output, node);
+		free(scene_output);
+	} else if (node->parent != NULL) {
+		free(node);
+	}
+}
+
+/* Destroys the tree of an output which is going away, without damaging the output. Surfaces
+   last shown on it leave it, they enter the output they are shown on next */
+void scene_output_destroy(struct kwm_scene *scene, struct kwm_scene_node *tree,
+						  struct wlr_output *wlr_output) {
+	struct kwm_scene_surface *scene_surface;
+	wl_list_for_each(scene_surface, &scene->surfaces, link) {
+		if (scene_surface->output == wlr_output) {
+			wlr_surface_send_leave(scene_surface->surface, wlr_output);
+			scene_surface->output = NULL;
+		}
+	}
+	scene_node_finish(tree);
+}
+
+void scene_node_destroy(struct kwm_scene_node *node) {
+	if (node == NULL) {
+		return;
+	}
+	scene_node_damage(node);
+	scene_node_finish(node);
+}
+
+void scene_destroy(struct kwm_scene *scene) {
+	scene_node_finish(&scene->tree);
+	free(scene);
+}
+
+void scene_node_set_enabled(struct kwm_scene_node *node, bool enabled) {
+	if (node->enabled == enabled) {
+		return;
+	}
+	if (!enabled) {
+		scene_node_damage(node);
+	}
+	node->enabled = enabled;
+	if (enabled) {
+		scene_node_damage(node);
+	}
+	scene_node_update_outputs(node);
+}
+
+void scene_node_set_position(struct kwm_scene_node *node, int x, int y) {
+	if (node->x == x && node->y == y) {
+		return;
+	}
+	scene_node_damage(node);
+	node->x = x, node->y = y;
+	scene_node_damage(node);
+}
+
+void scene_node_set_size(struct kwm_scene_node *node, int width, int height) {
+	if (node->width == width && node->height == height) {
+		return;
+	}
+	scene_node_damage(node);
+	node->width = width, node->height = height;
+	scene_node_damage(node);
+}
+
+void scene_node_set_tags(struct kwm_scene_node *node, uint32_t tags) {
+	if (node->tags == tags) {
+		return;
+	}
+	scene_node_damage(node);
+	node->tags = tags;
+	scene_node_damage(node);
+	scene_node_update_outputs(node);
+}
+
+void scene_node_raise_to_top(struct kwm_scene_node *node) {
+	if (node->parent == NULL || node->link.next == &node->parent->children) {
+		return;
+	}
+	wl_list_remove(&node->link);
+	wl_list_insert(node->parent->children.prev, &node->link);
+	scene_node_damage(node);
+}
+
+void scene_node_reparent(struct kwm_scene_node *node, struct kwm_scene_node *parent) {
+	if (node->parent == parent) {
+		return;
+	}
+	scene_node_damage(node);
+	wl_list_remove(&node->link);
+	node->parent = parent;
+	wl_list_insert(parent->children.prev, &node->link);
+	scene_node_damage(node);
+	scene_node_update_outputs(node);
+}
+
+/* Finds the top most surface node at the given layout coordinates and returns the
+   coordinates relative to that surface */
+struct kwm_scene_node *scene_node_at(struct kwm_scene_node *node, double lx, double ly,
+									 double *nx, double *ny) {
+	if (!node->enabled) {
+		return NULL;
+	}
+	lx -= node->x, ly -= node->y;
+
+	/* Children are stacked above their parent, so they are tested first, top most first */
+	struct kwm_scene_node *child;
+	wl_list_for_each_reverse(child, &node->children, link) {
+		struct kwm_scene_node *found = scene_node_at(child, lx, ly, nx, ny);
+		if (found != NULL) {
+			return found;
+		}
+	}
+
+	if (node->type == KWM_SCENE_SURFACE) {
+		struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+		/* With a viewport the buffer can be larger than the node */
+		if (lx < node->width && ly < node->height &&
+			wlr_surface_point_accepts_input(scene_surface->surface, lx, ly)) {
+			*nx = lx, *ny = ly;
+			return node;
+		}
+	}
+	return NULL;
+}
+
+/* Restricts rendering to a damaged rectangle, which is in output buffer coordinates
+   before the output transform is applied */
+static void scissor_output(struct wlr_output *wlr_output, struct wlr_renderer *renderer,
+						   pixman_box32_t *rect) {
+	struct wlr_box box = {
+		.x = rect->x1,
+		.y = rect->y1,
+		.width = rect->x2 - rect->x1,
+		.height = rect->y2 - rect->y1,
+	};
+	int width, height;
+	wlr_output_transformed_resolution(wlr_output, &width, &height);
+	enum wl_output_transform transform = wlr_output_transform_invert(wlr_output->transform);
+	wlr_box_transform(&box, &box, transform, width, height);
+	wlr_renderer_scissor(renderer, &box);
+}
+
+/* Converts a node box in output-local coordinates into output buffer coordinates, and
+   returns the damaged part of it */
+static bool node_damage_box(struct wlr_output *wlr_output, struct kwm_scene_node *node, int ox,
+							int oy, pixman_region32_t *damage, struct wlr_box *box,
+							pixman_region32_t *region) {
+	float scale = wlr_output->scale;
+	box->x = round(ox * scale);
+	box->y = round(oy * scale);
+	box->width = round((ox + node->width) * scale) - box->x;
+	box->height = round((oy + node->height) * scale) - box->y;
+
+	pixman_region32_init_rect(region, box->x, box->y, box->width, box->height);
+	pixman_region32_intersect(region, region, damage);
+	return pixman_region32_not_empty(region);
+}
+
+static void render_rect(struct kwm_scene_rect *rect, struct wlr_output *wlr_output,
+						struct wlr_renderer *renderer, int ox, int oy, pixman_region32_t *damage) {
+	struct wlr_box box;
+	pixman_region32_t region;
+	if (node_damage_box(wlr_output, &rect->node, ox, oy, damage, &box, &region)) {
+		int nrects;
+		pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+		for (int i = 0; i < nrects; i++) {
+			scissor_output(wlr_output, renderer, &rects[i]);
+			wlr_render_rect(renderer, &box, rect->color, wlr_output->transform_matrix);
+		}
+	}
+	pixman_region32_fini(&region);
+}
+
+/* This function renders an application surface */
+static void render_surface(struct kwm_scene_surface *scene_surface, struct wlr_output *wlr_output,
+						   struct wlr_renderer *renderer, int ox, int oy,
+						   pixman_region32_t *damage) {
+	/* We first obtain a wlr_texture, which is a GPU resource */
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wlr_texture *texture = scene_surface_get_texture(scene_surface);
+	if (texture == NULL) {
+		return;
+	}
+
+	struct wlr_box box;
+	pixman_region32_t region;
+	if (node_damage_box(wlr_output, &scene_surface->node, ox, oy, damage, &box, &region)) {
+		/* wlr_matrix_project_box is a helper which takes a box with a desired
+		   x, y coordinates, width and height, and an output geometry, then prepares
+		   an orthographic projection and multiplies the necessary transforms to
+		   produce a model-view-projection matrix. */
+		float matrix[9];
+		enum wl_output_transform transform =
+			wlr_output_transform_invert(surface->current.transform);
+		wlr_matrix_project_box(matrix, &box, transform, 0, wlr_output->transform_matrix);
+
+		/* A client drawing at the physical size of the output through a viewport is
+		   sampled one to one, there is no scaling pass */
+		struct wlr_fbox src;
+		bool viewport = surface_get_source_box(surface, &src);
+
+		int nrects;
+		pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+		for (int i = 0; i < nrects; i++) {
+			scissor_output(wlr_output, renderer, &rects[i]);
+			if (viewport) {
+				wlr_render_subtexture_with_matrix(renderer, texture, &src, matrix, 1);
+			} else {
+				wlr_render_texture_with_matrix(renderer, texture, matrix, 1);
+			}
+		}
+	}
+	pixman_region32_fini(&region);
+}
+
+static void render_node(struct kwm_scene_node *node, struct kwm_output *output,
+						struct wlr_renderer *renderer, int ox, int oy, pixman_region32_t *damage) {
+	if (!node->enabled || tags_hidden(node->tags, output->tags)) {
+		return;
+	}
+	struct wlr_output *wlr_output = output->wlr_output;
+	ox += node->x, oy += node->y;
+
+	if (node->type == KWM_SCENE_RECT) {
+		struct kwm_scene_rect *rect = wl_container_of(node, rect, node);
+		render_rect(rect, wlr_output, renderer, ox, oy, damage);
+	} else if (node->type == KWM_SCENE_SURFACE) {
+		struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+		render_surface(scene_surface, wlr_output, renderer, ox, oy, damage);
+	}
+
+	struct kwm_scene_node *child;
+	wl_list_for_each(child, &node->children, link) {
+		render_node(child, output, renderer, ox, oy, damage);
+	}
+}
+
+/* Draws the damaged part of a surface into the software framebuffer. Buffers shown one to
+   one are copied, scaled ones and the ones cropped by a viewport are filtered. Returns false
+   when the buffer is rotated or there is no copy of it, which the renderer has to draw */
+static bool raster_surface(struct kwm_scene_surface *scene_surface, struct kwm_output *output,
+						   int ox, int oy, pixman_region32_t *damage) {
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wlr_output *wlr_output = output->wlr_output;
+	if (surface->buffer == NULL) {
+		return true;
+	}
+	struct wlr_box box;
+	pixman_region32_t region;
+	if (!node_damage_box(wlr_output, &scene_surface->node, ox, oy, damage, &box, &region)) {
+		pixman_region32_fini(&region);
+		return true;
+	}
+	pixman_image_t *pixels = scene_surface->pixels;
+	if (pixels == NULL || surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		pixman_region32_fini(&region);
+		return false;
+	}
+
+	struct wlr_fbox src;
+	surface_get_source_box(surface, &src);
+	bool scaled = src.width != box.width || src.height != box.height || src.x != (int)src.x ||
+		src.y != (int)src.y;
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		if (scaled) {
+			raster_blit_scaled(&output->raster, &rects[i], pixels, &src, &box,
+							   scene_surface->opaque);
+		} else {
+			raster_blit(&output->raster, &rects[i], pixels, rects[i].x1 - box.x + src.x,
+						rects[i].y1 - box.y + src.y, scene_surface->opaque);
+		}
+	}
+	pixman_region32_fini(&region);
+	return true;
+}
+
+/* Draws the damaged part of a tree into the software framebuffer, returns false when a node
+   needs the renderer */
+static bool raster_node(struct kwm_scene_node *node, struct kwm_output *output, int ox, int oy,
+						pixman_region32_t *damage) {
+	if (!node->enabled || tags_hidden(node->tags, output->tags)) {
+		return true;
+	}
+	ox += node->x, oy += node->y;
+
+	if (node->type == KWM_SCENE_RECT) {
+		struct kwm_scene_rect *rect = wl_container_of(node, rect, node);
+		struct wlr_box box;
+		pixman_region32_t region;
+		if (node_damage_box(output->wlr_output, node, ox, oy, damage, &box, &region)) {
+			int nrects;
+			pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+			for (int i = 0; i < nrects; i++) {
+				raster_fill(&output->raster, &rects[i], rect->color);
+			}
+		}
+		pixman_region32_fini(&region);
+	} else if (node->type == KWM_SCENE_SURFACE) {
+		struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+		if (!raster_surface(scene_surface, output, ox, oy, damage)) {
+			return false;
+		}
+	}
+
+	struct kwm_scene_node *child;
+	wl_list_for_each(child, &node->children, link) {
+		if (!raster_node(child, output, ox, oy, damage)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Repaints the damaged part of an output in software, and shows the framebuffer through a
+   single texture. Returns false when the renderer has to draw the frame instead */
+static bool scene_raster_output(struct kwm_scene *scene, struct kwm_output *output,
+								struct wlr_renderer *renderer, struct wlr_box *output_box,
+								pixman_region32_t *damage) {
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct kwm_raster *raster = &output->raster;
+	if (wlr_output->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+		!raster_begin(raster, renderer, wlr_output->width, wlr_output->height)) {
+		return false;
+	}
+
+	/* A framebuffer which missed frames is drawn as a whole, only the damage is shown */
+	pixman_region32_t region;
+	pixman_region32_init(&region);
+	if (raster->valid) {
+		pixman_region32_copy(&region, damage);
+	} else {
+		pixman_region32_union_rect(&region, &region, 0, 0, wlr_output->width, wlr_output->height);
+	}
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		raster_fill(raster, &rects[i], background_color);
+	}
+	raster->valid = raster_node(output->scene_tree, output, -output_box->x, -output_box->y,
+								&region) && raster_upload(raster, damage);
+	pixman_region32_fini(&region);
+	if (!raster->valid) {
+		return false;
+	}
+
+	float matrix[9];
+	struct wlr_box box = {.width = wlr_output->width, .height = wlr_output->height};
+	wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+						   wlr_output->transform_matrix);
+	rects = pixman_region32_rectangles(damage, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		scissor_output(wlr_output, renderer, &rects[i]);
+		wlr_render_texture_with_matrix(renderer, raster->texture, matrix, 1);
+	}
+	return true;
+}
+
+/* This function repaints the damaged part of an output from its scene tree. The output must
+   already have a buffer attached */
+void scene_render_output(struct kwm_scene *scene, struct kwm_output *output,
+						 pixman_region32_t *damage) {
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+	struct wlr_box *output_box = wlr_output_layout_get_box(scene->layout, wlr_output);
+
+	wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
+
+	if (pixman_region32_not_empty(damage) && output_box != NULL &&
+		!(scene->software_rendering &&
+		  scene_raster_output(scene, output, renderer, output_box, damage))) {
+		int nrects;
+		pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+		for (int i = 0; i < nrects; i++) {
+			scissor_output(wlr_output, renderer, &rects[i]);
+			wlr_renderer_clear(renderer, background_color);
+		}
+		render_node(output->scene_tree, output, renderer, -output_box->x, -output_box->y, damage);
+	}
+
+	/* If a hardware cursor is not supported then render a software cursor instead */
+	wlr_output_render_software_cursors(wlr_output, damage);
+	wlr_renderer_scissor(renderer, NULL);
+	wlr_renderer_end(renderer);
+
+	/* Tell the backend which part of the buffer changed */
+	int width, height;
+	wlr_output_transformed_resolution(wlr_output, &width, &height);
+	pixman_region32_t frame_damage;
+	pixman_region32_init(&frame_damage);
+	enum wl_output_transform transform = wlr_output_transform_invert(wlr_output->transform);
+	wlr_region_transform(&frame_damage, &output->damage->current, transform, width, height);
+	wlr_output_set_damage(wlr_output, &frame_damage);
+	pixman_region32_fini(&frame_damage);
+}
+
+/* Let the clients that committed since the last frame know that they can start preparing
+   another one. Surfaces which are not shown keep waiting. */
+void scene_send_frame_done(struct kwm_scene *scene, struct kwm_output *output,
+						   struct timespec *when) {
+	struct kwm_scene_surface *scene_surface, *tmp;
+	wl_list_for_each_safe(scene_surface, tmp, &scene->frame_pending, frame_link) {
+		if (scene_node_shown_output(&scene_surface->node) != output) {
+			continue;
+		}
+		/* Clients over their frame-rate cap get their callbacks on a later frame */
+		if (!client_frame_done_allowed(output->server, scene_surface->surface, when)) {
+			continue;
+		}
+		wlr_surface_send_frame_done(scene_surface->surface, when);
+		wl_list_remove(&scene_surface->frame_link);
+		wl_list_init(&scene_surface->frame_link);
+	}
+}
@@ -0,0 +1,143 @@
+#ifndef KWM_SCENE_H
+#define KWM_SCENE_H
+
+#include <pixman.h>
+#include <wayland-server.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_xdg_shell.h>
+
+struct kwm_output;
+
+enum kwm_scene_node_type {
+	KWM_SCENE_TREE,
+	KWM_SCENE_OUTPUT,
+	KWM_SCENE_RECT,
+	KWM_SCENE_SURFACE,
+};
+
+/* A node of the retained scene. The tree is made of outputs, views, surfaces and decorations.
+   Positions are relative to the parent node and children are stacked from bottom to top, so
+   rendering walks the children forwards and hit-testing backwards. */
+struct kwm_scene_node {
+	enum kwm_scene_node_type type;
+	struct kwm_scene_node *parent;
+	struct wl_list link;
+	struct wl_list children;
+
+	bool enabled;
+	int x, y;
+	int width, height;
+	/* Tags of a view tree. A tagged node is only shown while its output shows one of them */
+	uint32_t tags;
+
+	/* Owner of the node, such as the kwm_view of a view tree */
+	void *data;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+};
+
+/* The root of the scene. Output trees sit at the layout origin and group the views of their
+   output, views are positioned in layout coordinates */
+struct kwm_scene {
+	struct kwm_scene_node tree;
+	struct wlr_output_layout *layout;
+	struct wlr_renderer *renderer;
+	/* Whether outputs are drawn on the CPU, software_rendering unless the bench says otherwise */
+	bool software_rendering;
+
+	/* Surfaces which committed since their last frame done event */
+	struct wl_list frame_pending;
+
+	/* All surface nodes, and the memory taken by their copies and textures */
+	struct wl_list surfaces;
+	size_t texture_bytes;
+	/* Hidden surfaces whose texture can be released, least recently shown first */
+	struct wl_list hidden;
+};
+
+struct kwm_scene_output {
+	struct kwm_scene_node node;
+	struct kwm_output *output;
+};
+
+struct kwm_scene_rect {
+	struct kwm_scene_node node;
+	float color[4];
+};
+
+struct kwm_scene_surface {
+	struct kwm_scene_node node;
+	struct kwm_scene *scene;
+	struct wlr_surface *surface;
+	struct wlr_subsurface *subsurface;
+	struct wl_list frame_link;
+	struct wl_list link;
+
+	/* Memory the copy of the buffer and the texture the surface is drawn with take */
+	size_t texture_bytes;
+
+	/* Copy of a shared memory buffer, its format and whether it covers what is below it. The
+	   software renderer draws from it */
+	pixman_image_t *pixels;
+	uint32_t format;
+	bool opaque;
+	/* Set once the texture of wlroots was released while the surface was hidden and over the
+	   budget. Until the client commits a new buffer, the surface is drawn with a texture
+	   uploaded from the copy when it is shown again */
+	bool evicted;
+	struct wlr_texture *texture;
+	struct wl_list hidden_link;
+
+	/* Output the surface is shown on, which the client was sent an enter event for */
+	struct wlr_output *output;
+
+	/* When set, the buffer is stretched to this size instead of the surface size */
+	int dest_width, dest_height;
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+	struct wl_listener new_subsurface;
+};
+
+struct kwm_scene *scene_create(struct wlr_output_layout *layout, struct wlr_renderer *renderer);
+void scene_destroy(struct kwm_scene *scene);
+struct kwm_scene_node *scene_tree_create(struct kwm_scene_node *parent);
+struct kwm_scene_node *scene_output_create(struct kwm_scene *scene, struct kwm_output *output);
+void scene_output_destroy(struct kwm_scene *scene, struct kwm_scene_node *tree,
+						  struct wlr_output *wlr_output);
+struct kwm_scene_rect *scene_rect_create(struct kwm_scene_node *parent, int width, int height,
+										 const float color[4]);
+struct kwm_scene_surface *scene_surface_create(struct kwm_scene_node *parent,
+											   struct wlr_surface *surface);
+struct kwm_scene_node *scene_xdg_surface_create(struct kwm_scene_node *parent,
+												struct wlr_xdg_surface *xdg_surface);
+struct kwm_scene_surface *scene_xdg_surface_get_surface(struct kwm_scene_node *tree);
+size_t scene_node_texture_bytes(struct kwm_scene_node *node);
+size_t scene_surface_texture_bytes(struct wlr_surface *surface);
+struct wlr_output *scene_surface_get_output(struct wlr_surface *surface);
+void scene_surface_set_dest_size(struct kwm_scene_surface *scene_surface, int width, int height);
+
+void scene_node_destroy(struct kwm_scene_node *node);
+void scene_node_set_enabled(struct kwm_scene_node *node, bool enabled);
+void scene_node_set_position(struct kwm_scene_node *node, int x, int y);
+void scene_node_set_size(struct kwm_scene_node *node, int width, int height);
+void scene_node_set_tags(struct kwm_scene_node *node, uint32_t tags);
+void scene_node_raise_to_top(struct kwm_scene_node *node);
+void scene_node_reparent(struct kwm_scene_node *node, struct kwm_scene_node *parent);
+void scene_node_coords(struct kwm_scene_node *node, int *lx, int *ly);
+bool scene_node_visible(struct kwm_scene_node *node);
+void scene_node_damage(struct kwm_scene_node *node);
+void scene_node_update_outputs(struct kwm_scene_node *node);
+struct kwm_scene_node *scene_node_at(struct kwm_scene_node *node, double lx, double ly,
+									 double *nx, double *ny);
+
+void scene_render_output(struct kwm_scene *scene, struct kwm_output *output,
+						 pixman_region32_t *damage);
+void scene_send_frame_done(struct kwm_scene *scene, struct kwm_output *output,
+						   struct timespec *when);
+
+#endif
@@ -1,67 +1,49 @@
 #include "server.h"
 #include "kwm.h"
+#include <linux/input-event-codes.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+#include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/edges.h>
 #include <wlr/util/log.h>
+#include <wlr/xcursor.h>
 
-/* XDG toplevels may have nested surfaces, such as popup windows for context menus
-   or tooltips. This function tests if any of those are underneath the coordinates
-   lx and ly (in output Layout coordinates). If so, it sets the surface pointer to
-   that wlr_surface and the sx and sy coordinates to the coordinates relative to
-   that surface's top-left corner. */
-bool view_at(struct kwm_view *view, double lx, double ly, struct wlr_surface **surface, double *sx,
-			 double *sy) {
-	double view_sx = lx - view->x;
-	double view_sy = ly - view->y;
+static const int border_width = 2;
+static const float border_color[4] = {1.0, 0.3, 0.3, 1.0};
 
-	struct wlr_surface_state *state = &view->xdg_surface->surface->current;
-
-	double _sx, _sy;
-	struct wlr_surface *_surface = NULL;
-	_surface = wlr_xdg_surface_surface_at(view->xdg_surface, view_sx, view_sy, &_sx, &_sy);
-
-	if (_surface != NULL) {
-		*sx = _sx;
-		*sy = _sy;
-		*surface = _surface;
-		return true;
-	}
-	return false;
-}
-
-/* This iterates over all of the surfaces and tries to find one under the cursor */
+/* This function finds the view under the given layout coordinates. Hit-testing walks the
+   views of the output underneath, top most first, and skips those whose tags are not shown.
+   If a surface is found the surface pointer is set to that wlr_surface and sx and sy to the
+   coordinates relative to that surface's top-left corner. */
 struct kwm_view *desktop_view_at(struct kwm_server *server, double lx, double ly,
 								 struct wlr_surface **surface, double *sx, double *sy) {
+	struct wlr_output *wlr_output = wlr_output_layout_output_at(server->output_layout, lx, ly);
+	if (wlr_output == NULL || wlr_output->data == NULL) {
+		return NULL;
+	}
+	struct kwm_output *output = wlr_output->data;
 	struct kwm_view *view;
-	/* wl_list_for_each(view, &server->views, link) { */
-	/* 	if (view_at(view, lx, ly, surface, sx, sy)) { */
-	/* 		return view; */
-	/* 	} */
-	/* } */
-	return NULL;
-}
-
-struct kwm_view *workspace_view_at(struct kwm_workspace *workspace, double lx, double ly,
-								   struct wlr_surface **surface, double *sx, double *sy) {
-	struct kwm_view *view;
-
-	wl_list_for_each(view, &workspace->views, link) {
-
-		double ox = 0, oy = 0;
-		wlr_output_layout_output_coords(view->server->output_layout, workspace->output->wlr_output,
-										&ox, &ox);
-		ox += view->x, oy += view->y;
-
-		if (view_at(view, ox, oy, surface, sx, sy)) {
+	wl_list_for_each_reverse(view, &output->views, link) {
+		if ((view->tags & output->tags) == 0) {
+			continue;
+		}
+		struct kwm_scene_node *node = scene_node_at(view->scene_tree, lx, ly, sx, sy);
+		if (node != NULL) {
+			struct kwm_scene_surface *scene_surface = wl_container_of(node, scene_surface, node);
+			*surface = scene_surface->surface;
 			return view;
 		}
 	}
 	return NULL;
 }
 
-/* This function sets the focus on a view */
+/* This function sets the focus on a view. Only the previously focused view and this one
+   are told about it and redraw their borders, the stacking order is left alone */
 void focus_view(struct kwm_view *view, struct wlr_surface *surface) {
 	/* Note: this function only deals with keyboard focus */
 	if (view == NULL) {
@@ -69,170 +51,263 @@ void focus_view(struct kwm_view *view, struct wlr_surface *surface) {
 	}
 	struct kwm_server *server = view->server;
 	struct wlr_seat *seat = server->seat;
-	struct wlr_surface *prev_surface = seat->keyboard_state.focused_surface;
-	if (prev_surface) {
-		/* Deactivate the previously focused surface. This lets the client know
-		   it no longer has focus and the client will repaint accordingly */
-		struct wlr_xdg_surface *previous =
-			wlr_xdg_surface_from_wlr_surface(seat->keyboard_state.focused_surface);
-		wlr_xdg_toplevel_set_activated(previous, false);
+	if (server->focused_view != view) {
+		if (server->focused_view != NULL) {
+			/* Deactivate the previously focused view. This lets the client know
+			   it no longer has focus and the client will repaint accordingly */
+			view_set_activated(server->focused_view, false);
+		}
+		server->focused_view = view;
+		state_mark_dirty(&server->state);
+
+		/* Move the view to the front of the focus stack */
+		wl_list_remove(&view->focus_link);
+		wl_list_insert(view->output != NULL ? &view->output->focus_stack : &server->parked_focus,
+					   &view->focus_link);
 	}
+
+	/* Activate the new view */
+	view_set_activated(view, true);
+
+	/* Tell the seat to have the keyboard enter this surface */
 	struct wlr_keyboard *keyboard = wlr_seat_get_keyboard(seat);
+	if (keyboard != NULL) {
+		wlr_seat_keyboard_notify_enter(seat, view_surface(view), keyboard->keycodes,
+									   keyboard->num_keycodes, &keyboard->modifiers);
+	} else {
+		wlr_seat_keyboard_notify_enter(seat, view_surface(view), NULL, 0, NULL);
+	}
+}
 
-	/* move the view to the front */
-	// wl_list_remove(&view->link);
-	// wl_list_insert(&server->views, &view->link);
+/* Returns the output underneath the cursor, if any */
+struct kwm_output *output_at_cursor(struct kwm_server *server) {
+	struct wlr_output *wlr_output =
+		wlr_output_layout_output_at(server->output_layout, server->cursor->x, server->cursor->y);
+	if (wlr_output == NULL) {
+		return NULL;
+	}
+	return wlr_output->data;
+}
 
-	/* Activate the new surface */
-	wlr_xdg_toplevel_set_activated(view->xdg_surface, true);
+/* Returns the most recently focused view of an output that is mapped and shown, skipping
+   the given one */
+static struct kwm_view *output_recent_view(struct kwm_output *output, struct kwm_view *skip) {
+	struct kwm_view *view;
+	wl_list_for_each(view, &output->focus_stack, focus_link) {
+		if (view != skip && view_is_visible(view)) {
+			return view;
+		}
+	}
+	return NULL;
+}
 
-	/* Tell the seat to have the keyboard enter this surface */
-	wlr_seat_keyboard_notify_enter(seat, view->xdg_surface->surface, keyboard->keycodes,
-								   keyboard->num_keycodes, &keyboard->modifiers);
+/* Hands the keyboard focus to the most recently focused shown view of an output, if there
+   is one */
+static void output_refocus(struct kwm_output *output) {
+	struct kwm_server *server = output->server;
+	struct kwm_view *focus = output_recent_view(output, NULL);
+	if (focus != NULL) {
+		focus_view(focus, view_surface(focus));
+		return;
+	}
+	if (server->focused_view != NULL) {
+		view_set_activated(server->focused_view, false);
+		server->focused_view = NULL;
+		state_mark_dirty(&server->state);
+	}
+	wlr_seat_keyboard_clear_focus(server->seat);
 }
 
-/* This function renders a view */
-void render_view(struct kwm_view *view, struct kwm_output *output, struct timespec now) {
-	if (!view->mapped) {
-		/* An unmapped view should not be rendered */
+/* This function changes the tags an output shows. No view is reconfigured, rendering and
+   hit-testing pick up the new mask, so the switch takes effect on the next frame. Surfaces
+   which got shown or hidden enter or leave the output */
+void output_set_tags(struct kwm_output *output, uint32_t tags) {
+	if (tags == 0 || tags == output->tags) {
 		return;
 	}
+	clock_now(&output->server->clock, &output->switch_start);
+	output->switch_pending = true;
+	output->tags = tags;
+	wlr_output_damage_add_whole(output->damage);
+	scene_node_update_outputs(output->scene_tree);
+	state_mark_dirty(&output->server->state);
+
+	/* Move the keyboard focus away from a view that got hidden */
+	struct kwm_view *focused = output->server->focused_view;
+	if (focused == NULL || (focused->output == output && !view_is_visible(focused))) {
+		output_refocus(output);
+	}
+}
 
-	/* The view has a position in layout coordinates. If you have two displays,
-	   one next to the other, both 1080p, a view on the right-most display might
-	   have layout coordinates of 2000,100. We need to translate that to
-	   output-local coordinates, or (2000-1928) */
-	double ox = 0, oy = 0;
-	wlr_output_layout_output_coords(view->server->output_layout, output->wlr_output, &ox, &ox);
-	ox += view->x, oy += view->y;
-
-	/* Render the border for the currently focused view */
-	if (view->xdg_surface->toplevel->current.activated) {
-		int border_width = 2;
-		float border_color[4] = {1.0, 0.3, 0.3, 1.0};
-
-		struct wlr_box border_top = {
-			.x = ox * output->wlr_output->scale,
-			.y = (oy - border_width) * output->wlr_output->scale,
-			.width = (border_width + view->xdg_surface->surface->current.width) *
-					 output->wlr_output->scale,
-			.height = border_width * output->wlr_output->scale};
-		wlr_render_rect(view->server->renderer, &border_top, border_color,
-						output->wlr_output->transform_matrix);
-		struct wlr_box border_bottom = {
-			.x = ox * output->wlr_output->scale,
-			.y = (oy + view->xdg_surface->surface->current.height) * output->wlr_output->scale,
-			.width = (border_width + view->xdg_surface->surface->current.width) *
-					 output->wlr_output->scale,
-			.height = border_width * output->wlr_output->scale};
-		wlr_render_rect(view->server->renderer, &border_bottom, border_color,
-						output->wlr_output->transform_matrix);
-		struct wlr_box border_left = {
-			.x = (ox - border_width) * output->wlr_output->scale,
-			.y = (oy - border_width) * output->wlr_output->scale,
-			.width = border_width * output->wlr_output->scale,
-			.height = (border_width * 2 + view->xdg_surface->surface->current.height) *
-					  output->wlr_output->scale};
-		wlr_render_rect(view->server->renderer, &border_left, border_color,
-						output->wlr_output->transform_matrix);
-		struct wlr_box border_right = {
-			.x = (ox + view->xdg_surface->surface->current.width) * output->wlr_output->scale,
-			.y = oy * output->wlr_output->scale,
-			.width = border_width * output->wlr_output->scale,
-			.height = (border_width + view->xdg_surface->surface->current.height) *
-					  output->wlr_output->scale};
-		wlr_render_rect(view->server->renderer, &border_right, border_color,
-						output->wlr_output->transform_matrix);
-	}
-
-	/* This calls the render_surface function for each surface amount the
-	   xdg_surface's toplevel and popups. */
-	struct render_data rdata = {.output = output->wlr_output,
-								.view = view,
-								.renderer = output->server->renderer,
-								.when = &now};
-	wlr_xdg_surface_for_each_surface(view->xdg_surface, render_surface, &rdata);
-}
-
-/* This function renderes an application surface */
-void render_surface(struct wlr_surface *surface, int sx, int sy, void *data) {
-	struct render_data *rdata = data;
-	struct kwm_view *view = rdata->view;
-	struct wlr_output *output = rdata->output;
-
-	/* We first obtain a wlr_texture, which is a GPU resource. */
-	struct wlr_texture *texture = wlr_surface_get_texture(surface);
-	if (texture == NULL) {
+/* Cycles the keyboard focus through the shown views of an output, most recently focused
+   first. The focused view goes to the back of the focus stack, so repeated calls visit every
+   view before coming back to it */
+void output_focus_next(struct kwm_output *output) {
+	struct kwm_view *focused = output->server->focused_view;
+	if (focused != NULL && focused->output != output) {
+		focused = NULL;
+	}
+	struct kwm_view *next = output_recent_view(output, focused);
+	if (next == NULL) {
 		return;
 	}
+	if (focused != NULL) {
+		wl_list_remove(&focused->focus_link);
+		wl_list_insert(output->focus_stack.prev, &focused->focus_link);
+	}
+	view_raise(next);
+	focus_view(next, view_surface(next));
+}
 
-	/* The view has a position in layout coordinates. If you have two displays,
-	   one next to the other, both 1080p, a view on the right-most display might
-	   have layout coordinates of 2000,100. We need to translate that to
-	   output-local coordinates, or (2000-1928) */
-	double ox = 0, oy = 0;
-	wlr_output_layout_output_coords(view->server->output_layout, output, &ox, &ox);
-	ox += view->x + sx, oy += view->y + sy;
+/* Moves a view to layout coordinates. X windows are told where they are */
+static void view_move(struct kwm_view *view, int x, int y) {
+	view->x = x, view->y = y;
+	scene_node_set_position(view->scene_tree, view->x, view->y);
+	if (view->type == KWM_VIEW_XWAYLAND) {
+		struct wlr_xwayland_surface *xsurface = view->xwayland_surface;
+		wlr_xwayland_surface_configure(xsurface, view->x, view->y, xsurface->width,
+									   xsurface->height);
+	}
+}
 
-	/* We also have to apply the scale factor for HiDPI outputs. NOTE: HiDPI support incomplete */
-	struct wlr_box box = {.x = ox * output->scale,
-						  .y = oy * output->scale,
-						  .width = surface->current.width * output->scale,
-						  .height = surface->current.height * output->scale};
+/* Moves a list of views and their focus stack on top of those of an output, or parks them
+   when output is NULL, shifting them by dx, dy. They are moved while they are not shown, so
+   only the output they land on is damaged, once per view */
+static void views_move(struct kwm_server *server, struct wl_list *views,
+					   struct wl_list *focus_stack, struct kwm_output *output, int dx, int dy) {
+	struct kwm_scene_node *tree = output != NULL ? output->scene_tree : &server->scene->tree;
+	wlr_log(WLR_INFO, "Moving %d views to %s", wl_list_length(views),
+			output != NULL ? output->wlr_output->name : "no output");
+	struct kwm_view *view;
+	wl_list_for_each(view, views, link) {
+		view->output = output;
+		view_move(view, view->x + dx, view->y + dy);
+		scene_node_reparent(view->scene_tree, tree);
+	}
 
-	/* wlr_matrix_project_box is a helper which takes a box with a desired
-	   x, y coordinates, width and height, and an output geometry, then prepares
-	   an orthographic projection and multiplies the necessary transforms to
-	   produce a model-view-projection matrix. */
-	float matrix[9];
-	enum wl_output_transform transform = wlr_output_transform_invert(surface->current.transform);
-	wlr_matrix_project_box(matrix, &box, transform, 0, output->transform_matrix);
+	/* They are less recently focused than the views already there */
+	wl_list_insert_list(output != NULL ? output->views.prev : server->parked_views.prev, views);
+	wl_list_insert_list(output != NULL ? output->focus_stack.prev : server->parked_focus.prev,
+						focus_stack);
+	wl_list_init(views);
+	wl_list_init(focus_stack);
+}
 
-	/* Take the matrix, texture, and an alpha and perform the actual rendering on the GPU */
-	wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
+/* Returns the time elapsed between two timestamps in microseconds */
+static long timespec_diff_us(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
 
-	/* Let the client know that we've displayed the frame and it can start preparing another one */
-	wlr_surface_send_frame_done(surface, rdata->when);
+/* Renders the damaged part of an output, if anything changed, and sets presented when a
+   frame was committed. Returns false when the output could not be rendered to */
+static bool output_render(struct kwm_output *output, bool *presented) {
+	/* wlr_output_damage_attach_render makes the OpenGL context current */
+	bool needs_frame;
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	if (!wlr_output_damage_attach_render(output->damage, &needs_frame, &damage)) {
+		pixman_region32_fini(&damage);
+		return false;
+	}
+
+	*presented = false;
+	if (needs_frame) {
+		scene_render_output(output->server->scene, output, &damage);
+		*presented = wlr_output_commit(output->wlr_output);
+	} else {
+		/* Don't leave the output with a buffer attached */
+		wlr_output_rollback(output->wlr_output);
+	}
+	pixman_region32_fini(&damage);
+	return true;
 }
 
-/* This function is called every time the output is ready to display a frame */
-void handle_output_frame(struct wl_listener *listener, void *data) {
-	struct kwm_output *output = wl_container_of(listener, output, frame);
-	struct wlr_renderer *renderer = output->server->renderer;
+/* This function shows a frame on an output and answers the frame callbacks of the surfaces
+   shown on it, stamped with the given time */
+static void output_frame(struct kwm_output *output, struct timespec *now) {
+	struct kwm_server *server = output->server;
 
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* Nothing is composited while idle, the damage is repainted on wake up */
+	if (server->idle.state != KWM_IDLE_ACTIVE) {
+		return;
+	}
 
-	/* wlr_output_attach_render makes the OpenGL context current */
-	if (!wlr_output_attach_render(output->wlr_output, NULL)) {
+	/* A backend still presenting the previous frame keeps the damage for the next one. Clients
+	   only hear about frames which were drawn */
+	struct wlr_output *wlr_output = output->wlr_output;
+	if (wlr_output->frame_pending) {
 		return;
 	}
+	struct timespec start, end;
+	bool presented;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!output_render(output, &presented)) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	/* The "effective" resolution can change if you rotate your outputs. */
-	int width, height;
-	wlr_output_effective_resolution(output->wlr_output, &width, &height);
+	/* On the virtual clock the vsync timer presents frames. The headless backend paces them
+	   in real time, it is told right away that the frame is done so that it never holds the
+	   next refresh back */
+	if (presented && server->clock.virtual) {
+		wlr_output_send_frame(wlr_output);
+	}
 
-	/* Begin the renderer (calls glViewport and some other GL checks */
-	wlr_renderer_begin(renderer, width, height);
+	scene_send_frame_done(server->scene, output, now);
+	if (!presented) {
+		return;
+	}
 
-	/* Render the background color */
-	float color[4] = {0.3, 0.3, 0.3, 1.0};
-	wlr_renderer_clear(renderer, color);
+	/* The state page carries the statistics of the frames which were presented */
+	output->frames++;
+	output->last_frame_ns = now->tv_sec * 1000000000ULL + now->tv_nsec;
+	output->render_us = timespec_diff_us(&start, &end);
+	output->render_us_avg = (output->render_us_avg * 7 + output->render_us) / 8;
+	state_frame(&server->state);
+
+	/* Report how long it took for a tag switch to reach the screen */
+	if (output->switch_pending) {
+		struct timespec done;
+		clock_now(&server->clock, &done);
+		wlr_log(WLR_INFO, "Tag switch on %s took %ld us", output->wlr_output->name,
+				timespec_diff_us(&output->switch_start, &done));
+		output->switch_pending = false;
+	}
+}
 
-	/* Render all of the views */
-	struct kwm_view *view;
-	// wl_list_for_each_reverse(view, &output->server->views, link) { render_view(view, output,
-	// now); }
-	wl_list_for_each_reverse(view, &output->active_workspace->views, link) {
-		render_view(view, output, now);
+/* This function is called every time the output is ready to display a frame. Only the
+   damaged part of the output is repainted, and nothing at all if nothing changed */
+void handle_output_frame(struct wl_listener *listener, void *data) {
+	struct kwm_output *output = wl_container_of(listener, output, frame);
+	/* On the virtual clock frames follow the vsync timer of the output instead */
+	if (output->server->clock.virtual) {
+		return;
 	}
+	struct timespec now;
+	clock_now(&output->server->clock, &now);
+	output_frame(output, &now);
+}
 
-	/* If a hardware cursor is not supported then render a software cursor instead */
-	wlr_output_render_software_cursors(output->wlr_output, NULL);
+/* Arms the vsync timer for the next refresh of the output. Refreshes are kept at the exact
+   refresh period, even though timers only have millisecond precision */
+static void output_schedule_vsync(struct kwm_output *output) {
+	int refresh = output->wlr_output->refresh > 0 ? output->wlr_output->refresh : 60000;
+	output->vsync_ns += 1000000000000LL / refresh;
+	struct timespec now;
+	clock_now(&output->server->clock, &now);
+	int64_t now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+	int ms = (output->vsync_ns - now_ns + 999999) / 1000000;
+	clock_timer_update(output->vsync, ms > 0 ? ms : 1);
+}
 
-	/* Conclude rendering and swap the buffers */
-	wlr_renderer_end(renderer);
-	wlr_output_commit(output->wlr_output);
+/* This function is called at every refresh of an output on the virtual clock */
+static int handle_output_vsync(void *data) {
+	struct kwm_output *output = data;
+	struct timespec now;
+	clock_now(&output->server->clock, &now);
+	output_frame(output, &now);
+	output_schedule_vsync(output);
+	return 0;
 }
 
 /* This function is called whenever a new display output is attached */
@@ -245,51 +320,145 @@ void handle_new_output(struct wl_listener *listener, void *data) {
 	if (!wl_list_empty(&wlr_output->modes)) {
 		struct wlr_output_mode *mode = wlr_output_preferred_mode(wlr_output);
 		wlr_output_set_mode(wlr_output, mode);
-		wlr_output_enable(wlr_output, true);
-		if (!wlr_output_commit(wlr_output)) {
-			return;
-		}
 	}
+	wlr_output_set_scale(wlr_output, output_rule_scale(wlr_output->name));
+	wlr_output_enable(wlr_output, true);
+	if (!wlr_output_commit(wlr_output)) {
+		return;
+	}
+
+	/* Load the cursor theme at the scale of the output so that the cursor is sharp */
+	cursor_theme_load(server, wlr_output->scale);
 
 	/* Allocates and configures state for this output */
 	struct kwm_output *output = calloc(1, sizeof(struct kwm_output));
 	output->wlr_output = wlr_output;
 	output->server = server;
-	wl_list_init(&output->workspaces);
-
-	struct kwm_workspace *workspace = calloc(1, sizeof(struct kwm_workspace));
-	workspace->output = output;
-	wl_list_init(&workspace->views);
+	/* Listen before the output damage does, so that it is still around on destroy */
+	output->destroy.notify = handle_output_destroy;
+	wl_signal_add(&wlr_output->events.destroy, &output->destroy);
+	output->damage = wlr_output_damage_create(wlr_output);
+	output->scene_tree = scene_output_create(server->scene, output);
+	output->tags = 1;
+	wl_list_init(&output->views);
+	wl_list_init(&output->focus_stack);
 
 	/* Attach the kwm_output reference to data so we can look it up later */
 	wlr_output->data = output;
 
-	output->active_workspace = workspace;
-
-	/* Create a workspace for the new output */
-	/* Assign the output to our workspaces */
-	/* for (int i = 0; i <= 9; i++) { */
-	/* 	if (!server->workspaces[i]->output || wl_list_empty(&server->workspaces[i]->views)) { */
-	/* 		server->workspaces[i]->output = output; */
-	/* 	} */
-	/* } */
-
-	/* Sets up a listener for the frame notify event */
+	/* Sets up a listener for the frame notify event. The output damage only emits it when
+	   a frame is due */
 	output->frame.notify = handle_output_frame;
-	wl_signal_add(&wlr_output->events.frame, &output->frame);
+	wl_signal_add(&output->damage->events.frame, &output->frame);
+	if (server->clock.virtual) {
+		output->vsync = clock_add_timer(&server->clock, handle_output_vsync, output);
+		if (output->vsync != NULL) {
+			struct timespec now;
+			clock_now(&server->clock, &now);
+			output->vsync_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+			output_schedule_vsync(output);
+		}
+	}
 	wl_list_insert(&server->outputs, &output->link);
 
 	/* Adds this output to the layout. The add_auto function arranges outputs from
 	   left-to-right in the order they appear */
 	wlr_output_layout_add_auto(server->output_layout, wlr_output);
 
+	/* Views that were left without an output show up on this one */
+	if (!wl_list_empty(&server->parked_views)) {
+		struct wlr_box *box = wlr_output_layout_get_box(server->output_layout, wlr_output);
+		views_move(server, &server->parked_views, &server->parked_focus, output, box->x, box->y);
+	}
+
 	/* Creating the global adds a wl_output global to the display, which Wayland clients
 	   can see to find out information about the output */
 	wlr_output_create_global(wlr_output);
+	state_mark_dirty(&server->state);
 }
 
-/* This function is called whenever a display is detached */
-void handle_output_destroy(struct wl_listener *listener, void *data) {}
+/* This function is called whenever a display is detached. Its views move in one batch to the
+   first remaining output, keeping their tags, stacking order and place relative to the
+   output, or are parked until another output is attached */
+void handle_output_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_output *output = wl_container_of(listener, output, destroy);
+	struct kwm_server *server = output->server;
+	struct wlr_output *wlr_output = output->wlr_output;
+	wlr_log(WLR_INFO, "Output %s detached", wlr_output->name);
+
+	/* Nothing is drawn on the output anymore, moving its views only damages their new output */
+	wl_list_remove(&output->link);
+	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->destroy.link);
+	output->scene_tree->enabled = false;
+	wlr_output->data = NULL;
+
+	if (server->grabbed_view != NULL && server->grabbed_view->output == output) {
+		end_interactive(server);
+	}
+
+	struct kwm_output *target = NULL;
+	int dx = 0, dy = 0;
+	struct wlr_box *box = wlr_output_layout_get_box(server->output_layout, wlr_output);
+	if (box != NULL) {
+		dx = -box->x, dy = -box->y;
+	}
+	if (!wl_list_empty(&server->outputs)) {
+		target = wl_container_of(server->outputs.next, target, link);
+		box = wlr_output_layout_get_box(server->output_layout, target->wlr_output);
+		if (box != NULL) {
+			dx += box->x, dy += box->y;
+		}
+	}
+	views_move(server, &output->views, &output->focus_stack, target, dx, dy);
+
+	struct kwm_view *focused = server->focused_view;
+	if (target != NULL && focused != NULL && focused->output == target &&
+		!view_is_visible(focused)) {
+		output_refocus(target);
+	}
+
+	scene_output_destroy(server->scene, output->scene_tree, wlr_output);
+	if (output->vsync != NULL) {
+		clock_timer_remove(output->vsync);
+	}
+	raster_finish(&output->raster);
+	free(output);
+	state_mark_dirty(&server->state);
+}
+
+static void find_headless_backend(struct wlr_backend *backend, void *data) {
+	struct wlr_backend **headless = data;
+	if (wlr_backend_is_headless(backend)) {
+		*headless = backend;
+	}
+}
+
+/* Runs a command of the test driver which is not about time, returns false for unknown ones.
+   "unplug NAME" detaches an output and "plug" attaches a new headless one, so that hotplug
+   can be tested without hardware */
+bool server_driver_command(struct kwm_server *server, const char *command) {
+	if (strncmp(command, "unplug ", 7) == 0) {
+		struct kwm_output *output;
+		wl_list_for_each(output, &server->outputs, link) {
+			if (strcmp(output->wlr_output->name, command + 7) == 0) {
+				wlr_output_destroy(output->wlr_output);
+				return true;
+			}
+		}
+		return false;
+	}
+	if (strcmp(command, "plug") == 0) {
+		struct wlr_backend *headless = NULL;
+		if (wlr_backend_is_multi(server->backend)) {
+			wlr_multi_for_each_backend(server->backend, find_headless_backend, &headless);
+		} else {
+			find_headless_backend(server->backend, &headless);
+		}
+		return headless != NULL && wlr_headless_add_output(headless, 1280, 720) != NULL;
+	}
+	return false;
+}
 
 /* This function is called whenever a new pointer device becomes available */
 void add_new_pointer(struct kwm_server *server, struct wlr_input_device *device) {
@@ -299,6 +468,16 @@ void add_new_pointer(struct kwm_server *server, struct wlr_input_device *device)
 	wlr_cursor_attach_input_device(server->cursor, device);
 }
 
+/* Lets the seat know what the input capabilities are. There is always a cursor even when
+   there are no pointer devices, so we always include that capability */
+static void seat_update_capabilities(struct kwm_server *server) {
+	uint32_t caps = WL_SEAT_CAPABILITY_POINTER;
+	if (!wl_list_empty(&server->keyboards)) {
+		caps |= WL_SEAT_CAPABILITY_KEYBOARD;
+	}
+	wlr_seat_set_capabilities(server->seat, caps);
+}
+
 /* This function is called whenever a new input device becomes available */
 void handle_new_input(struct wl_listener *listener, void *data) {
 	struct kwm_server *server = wl_container_of(listener, server, new_input);
@@ -314,14 +493,7 @@ void handle_new_input(struct wl_listener *listener, void *data) {
 	default:
 		break;
 	}
-
-	/* We need to let the seat know what the input capabilities are. There is always a cursor
-	   even when there are no pointer devices, so we always include that capability */
-	uint32_t caps = WL_SEAT_CAPABILITY_POINTER;
-	if (!wl_list_empty(&server->keyboards)) {
-		caps |= WL_SEAT_CAPABILITY_KEYBOARD;
-	}
-	wlr_seat_set_capabilities(server->seat, caps);
+	seat_update_capabilities(server);
 }
 
 void process_cursor_motion(struct kwm_server *server, uint32_t time) {
@@ -337,16 +509,12 @@ void process_cursor_motion(struct kwm_server *server, uint32_t time) {
 	double sx, sy;
 	struct wlr_seat *seat = server->seat;
 	struct wlr_surface *surface = NULL;
-	struct wlr_output *wlr_output =
-		wlr_output_layout_output_at(server->output_layout, server->cursor->x, server->cursor->y);
-	struct kwm_output *output = wlr_output->data;
-	struct kwm_view *view = workspace_view_at(output->active_workspace, server->cursor->x,
-											  server->cursor->y, &surface, &sx, &sy);
-	/* 	desktop_view_at(server, server->cursor->x, server->cursor->y, &surface, &sx, &sy); */
+	struct kwm_view *view =
+		desktop_view_at(server, server->cursor->x, server->cursor->y, &surface, &sx, &sy);
 
 	if (!view) {
 		/* If there is no view under the cursor, set the cursor image to default */
-		wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, "right_ptr", server->cursor);
+		cursor_set_image(server, "right_ptr");
 	}
 	if (surface) {
 		bool focus_changed = seat->pointer_state.focused_surface != surface;
@@ -366,22 +534,146 @@ void process_cursor_motion(struct kwm_server *server, uint32_t time) {
 
 /* Moves the grabbed view to the new position */
 void process_cursor_move(struct kwm_server *server, uint32_t time) {
-	struct wlr_output *wlr_output =
-		wlr_output_layout_output_at(server->output_layout, server->cursor->x, server->cursor->y);
-	struct kwm_output *output = wlr_output->data;
+	struct kwm_view *view = server->grabbed_view;
+	view_move(view, server->cursor->x - server->grab_x, server->cursor->y - server->grab_y);
+}
 
-	server->grabbed_view->x = server->cursor->x - server->grab_x;
-	server->grabbed_view->y = server->cursor->y - server->grab_y;
+/* Keeps the border decoration in line with the size and activation state of the view */
+void view_update_borders(struct kwm_view *view) {
+	if (view->surface_node == NULL) {
+		return;
+	}
+	int width = view->surface_node->node.width;
+	int height = view->surface_node->node.height;
+	/* Override redirect X windows such as menus and tooltips are never decorated */
+	bool activated = view->activated;
+	if (view->type == KWM_VIEW_XWAYLAND && view->xwayland_surface->override_redirect) {
+		activated = false;
+	}
+
+	struct wlr_box boxes[4] = {
+		{-border_width, -border_width, width + border_width * 2, border_width},
+		{-border_width, height, width + border_width * 2, border_width},
+		{-border_width, 0, border_width, height},
+		{width, 0, border_width, height},
+	};
+	for (int i = 0; i < 4; i++) {
+		struct kwm_scene_node *node = &view->borders[i]->node;
+		scene_node_set_position(node, boxes[i].x, boxes[i].y);
+		scene_node_set_size(node, boxes[i].width, boxes[i].height);
+		scene_node_set_enabled(node, activated);
+	}
 }
 
-/* Resizes the grabbed view */
-void process_cursor_resize(struct kwm_server *server, uint32_t time) {}
+/* Places a view that is being resized. The edges opposite to the grabbed ones stay in place
+   and until the client caught up with the requested size, its last buffer is stretched */
+static void view_apply_resize(struct kwm_view *view) {
+	struct wlr_box geo_box;
+	view_get_geometry(view, &geo_box);
+	struct wlr_surface *surface = view_surface(view);
+
+	int surface_width, surface_height;
+	surface_get_size(surface, &surface_width, &surface_height);
+
+	int width = geo_box.width, height = geo_box.height;
+	if (view->resizing) {
+		width = view->resize_width, height = view->resize_height;
+		scene_surface_set_dest_size(view->surface_node, surface_width + width - geo_box.width,
+									surface_height + height - geo_box.height);
+	} else {
+		scene_surface_set_dest_size(view->surface_node, 0, 0);
+	}
+
+	int left = view->resize_grab.x, top = view->resize_grab.y;
+	if (view->resize_edges & WLR_EDGE_LEFT) {
+		left += view->resize_grab.width - width;
+	}
+	if (view->resize_edges & WLR_EDGE_TOP) {
+		top += view->resize_grab.height - height;
+	}
+	view->x = left - geo_box.x;
+	view->y = top - geo_box.y;
+	scene_node_set_position(view->scene_tree, view->x, view->y);
+}
+
+/* X windows have no configure serials. A configure counts as outstanding until the window
+   commits again, which the X client does once it redrew at the new size */
+static void view_flush_xwayland_resize(struct kwm_view *view) {
+	if (view->resize_width == view->configured_width &&
+		view->resize_height == view->configured_height) {
+		return;
+	}
+	int left = view->resize_grab.x, top = view->resize_grab.y;
+	if (view->resize_edges & WLR_EDGE_LEFT) {
+		left += view->resize_grab.width - view->resize_width;
+	}
+	if (view->resize_edges & WLR_EDGE_TOP) {
+		top += view->resize_grab.height - view->resize_height;
+	}
+	view->configured_width = view->resize_width;
+	view->configured_height = view->resize_height;
+	wlr_xwayland_surface_configure(view->xwayland_surface, left, top, view->resize_width,
+								   view->resize_height);
+	view->resize_serial = 1;
+}
+
+/* Sends the latest requested size to the client, unless it has not acked the previous
+   configure yet. Sizes requested in the meantime are coalesced into the next configure */
+static void view_flush_resize(struct kwm_view *view) {
+	if (view->resize_serial != 0) {
+		return;
+	}
+	if (view->type == KWM_VIEW_XWAYLAND) {
+		view_flush_xwayland_resize(view);
+		return;
+	}
+	uint32_t serial = 0;
+	if (view->resize_width != view->configured_width ||
+		view->resize_height != view->configured_height) {
+		view->configured_width = view->resize_width;
+		view->configured_height = view->resize_height;
+		serial = wlr_xdg_toplevel_set_size(view->xdg_surface, view->resize_width,
+										   view->resize_height);
+	}
+	if (!view->resize_grabbed && view->xdg_surface->toplevel->server_pending.resizing) {
+		serial = wlr_xdg_toplevel_set_resizing(view->xdg_surface, false);
+	}
+	view->resize_serial = serial;
+}
+
+/* Resizes the grabbed view. This only records the size the pointer asks for, the client
+   is configured with it once it caught up with the previous size */
+void process_cursor_resize(struct kwm_server *server, uint32_t time) {
+	struct kwm_view *view = server->grabbed_view;
+	double dx = server->cursor->x - server->grab_x;
+	double dy = server->cursor->y - server->grab_y;
+
+	int width = server->grab_width, height = server->grab_height;
+	if (server->resize_edges & WLR_EDGE_LEFT) {
+		width -= dx;
+	} else if (server->resize_edges & WLR_EDGE_RIGHT) {
+		width += dx;
+	}
+	if (server->resize_edges & WLR_EDGE_TOP) {
+		height -= dy;
+	} else if (server->resize_edges & WLR_EDGE_BOTTOM) {
+		height += dy;
+	}
+
+	view->resize_width = width < 1 ? 1 : width;
+	view->resize_height = height < 1 ? 1 : height;
+	view_flush_resize(view);
+	view_apply_resize(view);
+	view_update_borders(view);
+}
 
 /* This function is called when a pointer emits a _relative_
    pointer motion event (i.e. a delta) */
 void handle_cursor_motion(struct wl_listener *listener, void *data) {
 	struct kwm_server *server = wl_container_of(listener, server, cursor_motion);
 	struct wlr_event_pointer_motion *event = data;
+	loop_record_input(&server->loop, event->time_msec);
+	idle_notify_activity(&server->idle);
 	/* The cursor doesn't move unless we tell it to. The cursor automatically
 	   handles constraining the motion to the output layout */
 	wlr_cursor_move(server->cursor, event->device, event->delta_x, event->delta_y);
@@ -395,6 +687,8 @@ void handle_cursor_motion(struct wl_listener *listener, void *data) {
 void handle_cursor_motion_abs(struct wl_listener *listener, void *data) {
 	struct kwm_server *server = wl_container_of(listener, server, cursor_motion_abs);
 	struct wlr_event_pointer_motion_absolute *event = data;
+	loop_record_input(&server->loop, event->time_msec);
+	idle_notify_activity(&server->idle);
 	wlr_cursor_warp_absolute(server->cursor, event->device, event->x, event->y);
 	process_cursor_motion(server, event->time_msec);
 }
@@ -405,23 +699,23 @@ void handle_cursor_button(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_button *event = data;
 	struct wlr_seat *seat = server->seat;
 	double sx, sy;
-	struct wlr_surface *surface;
+	struct wlr_surface *surface = NULL;
+	loop_record_input(&server->loop, event->time_msec);
+	idle_notify_activity(&server->idle);
 
-	/* struct kwm_view *view = */
-	/* 	desktop_view_at(server, server->cursor->x, server->cursor->y, &surface, &sx, &sy); */
-	struct wlr_output *wlr_output =
-		wlr_output_layout_output_at(server->output_layout, server->cursor->x, server->cursor->y);
-	struct kwm_output *output = wlr_output->data;
-	struct kwm_view *view = workspace_view_at(output->active_workspace, server->cursor->x,
-											  server->cursor->y, &surface, &sx, &sy);
+	struct kwm_view *view =
+		desktop_view_at(server, server->cursor->x, server->cursor->y, &surface, &sx, &sy);
 
 	// seat->keyboard_state->keyboard
 	/* Check if the mod key is being pressed */
-	bool handled = false;
 	uint32_t modifiers = wlr_keyboard_get_modifiers(seat->keyboard_state.keyboard);
 	if ((modifiers & WLR_MODIFIER_ALT) && event->state == WLR_KEY_PRESSED) {
-		// server->cursor_mode = KWM_CURSOR_MOVE;
-		begin_interactive(view, KWM_CURSOR_MOVE, 0);
+		/* The right button resizes from the bottom right corner, any other one moves */
+		if (event->button == BTN_RIGHT) {
+			begin_interactive(view, KWM_CURSOR_RESIZE, WLR_EDGE_BOTTOM | WLR_EDGE_RIGHT);
+		} else {
+			begin_interactive(view, KWM_CURSOR_MOVE, 0);
+		}
 		return;
 	}
 
@@ -430,15 +724,23 @@ void handle_cursor_button(struct wl_listener *listener, void *data) {
 
 	if (event->state == WLR_BUTTON_RELEASED) {
 		/* If a button was released, we exit interactive move/resize mode */
-		server->cursor_mode = KWM_CURSOR_PASSTHROUGH;
+		end_interactive(server);
 	} else {
-		/* Focus the client if the button was pressed */
+		/* Focus the client if the button was pressed and bring it to the front */
+		if (view != NULL) {
+			view_raise(view);
+		}
 		focus_view(view, surface);
 	}
 }
 
 /* This function is called whenever a mouse wheel is scrolled */
-void handle_cursor_axis(struct wl_listener *listener, void *data) {}
+void handle_cursor_axis(struct wl_listener *listener, void *data) {
+	struct kwm_server *server = wl_container_of(listener, server, cursor_axis);
+	struct wlr_event_pointer_axis *event = data;
+	loop_record_input(&server->loop, event->time_msec);
+	idle_notify_activity(&server->idle);
+}
 
 /* This function is called when a pointer emits a frame event */
 void handle_cursor_frame(struct wl_listener *listener, void *data) {
@@ -479,6 +781,8 @@ void handle_keyboard_key(struct wl_listener *listener, void *data) {
 	struct kwm_server *server = keyboard->server;
 	struct wlr_event_keyboard_key *event = data;
 	struct wlr_seat *seat = server->seat;
+	loop_record_input(&server->loop, event->time_msec);
+	idle_notify_activity(&server->idle);
 
 	/* Translate libinput keycode -> xkbcommon */
 	uint32_t keycode = event->keycode + 8;
@@ -502,21 +806,30 @@ void handle_keyboard_key(struct wl_listener *listener, void *data) {
 	}
 }
 
-/* This function is called to register a new keyboard */
-void add_new_keyboard(struct kwm_server *server, struct wlr_input_device *device) {
-	struct kwm_keyboard *keyboard = calloc(1, sizeof(struct kwm_keyboard));
-	keyboard->server = server;
-	keyboard->device = device;
+/* The compilation of the keymap of a new keyboard, which takes tens of milliseconds */
+struct kwm_keymap_task {
+	struct kwm_task task;
+	struct kwm_keyboard *keyboard;
+	struct xkb_keymap *keymap;
+};
 
-	/* Prepare an XKB keymap and assign it to the keyboard */
+/* This function runs on a worker thread, so it uses its own XKB context */
+static void keymap_task_run(struct kwm_task *task) {
+	struct kwm_keymap_task *keymap_task = wl_container_of(task, keymap_task, task);
 	struct xkb_rule_names rules = {0};
 	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	struct xkb_keymap *keymap =
-		xkb_map_new_from_names(context, &rules, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (context == NULL) {
+		return;
+	}
+	keymap_task->keymap = xkb_map_new_from_names(context, &rules, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	xkb_context_unref(context);
+}
 
+/* Assigns the keymap to the keyboard and starts using it */
+static void keyboard_setup(struct kwm_keyboard *keyboard, struct xkb_keymap *keymap) {
+	struct kwm_server *server = keyboard->server;
+	struct wlr_input_device *device = keyboard->device;
 	wlr_keyboard_set_keymap(device->keyboard, keymap);
-	xkb_keymap_unref(keymap);
-	xkb_context_unref(context);
 	wlr_keyboard_set_repeat_info(device->keyboard, 25, 600);
 
 	/* Set up listeners for keyboard events */
@@ -529,33 +842,387 @@ void add_new_keyboard(struct kwm_server *server, struct wlr_input_device *device
 
 	/* add the keyboard to our list of keyboards */
 	wl_list_insert(&server->keyboards, &keyboard->link);
+	seat_update_capabilities(server);
+}
+
+static void keymap_task_done(struct kwm_task *task) {
+	struct kwm_keymap_task *keymap_task = wl_container_of(task, keymap_task, task);
+	struct kwm_keyboard *keyboard = keymap_task->keyboard;
+	if (keyboard != NULL) {
+		keyboard->keymap_task = NULL;
+		if (keymap_task->keymap == NULL) {
+			wlr_log(WLR_ERROR, "Failed to compile the keymap of %s", keyboard->device->name);
+		} else if (!task->cancelled) {
+			keyboard_setup(keyboard, keymap_task->keymap);
+		}
+	}
+	if (keymap_task->keymap != NULL) {
+		xkb_keymap_unref(keymap_task->keymap);
+	}
+	free(keymap_task);
+}
+
+/* This function is called to register a new keyboard. It is only used once its keymap is
+   compiled on the worker pool */
+void add_new_keyboard(struct kwm_server *server, struct wlr_input_device *device) {
+	struct kwm_keyboard *keyboard = calloc(1, sizeof(struct kwm_keyboard));
+	struct kwm_keymap_task *keymap_task = calloc(1, sizeof(struct kwm_keymap_task));
+	if (keyboard == NULL || keymap_task == NULL) {
+		free(keyboard);
+		free(keymap_task);
+		return;
+	}
+	keyboard->server = server;
+	keyboard->device = device;
+	wl_list_init(&keyboard->link);
+	wl_list_init(&keyboard->modifiers.link);
+	wl_list_init(&keyboard->key.link);
+	keyboard->destroy.notify = handle_input_destroy;
+	wl_signal_add(&device->events.destroy, &keyboard->destroy);
+
+	keyboard->keymap_task = keymap_task;
+	keymap_task->keyboard = keyboard;
+	keymap_task->task.name = "keymap";
+	keymap_task->task.run = keymap_task_run;
+	keymap_task->task.done = keymap_task_done;
+	pool_submit(&server->pool, &keymap_task->task);
+}
+
+/* This function is called when an input device goes away. Only keyboards listen to it */
+void handle_input_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_keyboard *keyboard = wl_container_of(listener, keyboard, destroy);
+	struct kwm_server *server = keyboard->server;
+	if (keyboard->keymap_task != NULL) {
+		/* The keymap is dropped once it is compiled */
+		keyboard->keymap_task->keyboard = NULL;
+	}
+	wl_list_remove(&keyboard->modifiers.link);
+	wl_list_remove(&keyboard->key.link);
+	wl_list_remove(&keyboard->destroy.link);
+	wl_list_remove(&keyboard->link);
+	free(keyboard);
+	seat_update_capabilities(server);
+}
+
+/* The loading of a cursor theme at some scale, which reads many files */
+struct kwm_cursor_task {
+	struct kwm_task task;
+	struct kwm_server *server;
+	struct kwm_cursor_theme *cursor_theme;
+	char *name;
+	uint32_t size;
+	struct wlr_xcursor_theme *theme;
+};
+
+static void cursor_task_run(struct kwm_task *task) {
+	struct kwm_cursor_task *cursor_task = wl_container_of(task, cursor_task, task);
+	cursor_task->theme = wlr_xcursor_theme_load(
+		cursor_task->name, cursor_task->size * cursor_task->cursor_theme->scale);
+}
+
+/* Hands the loaded theme to its entry in the theme cache. A theme which failed to load is
+   dropped from the cache, so that the next output at its scale tries again */
+static void cursor_task_done(struct kwm_task *task) {
+	struct kwm_cursor_task *cursor_task = wl_container_of(task, cursor_task, task);
+	struct kwm_cursor_theme *cursor_theme = cursor_task->cursor_theme;
+	if (task->cancelled) {
+		if (cursor_task->theme != NULL) {
+			wlr_xcursor_theme_destroy(cursor_task->theme);
+		}
+	} else if (cursor_task->theme == NULL) {
+		wlr_log(WLR_ERROR, "Failed to load the cursor theme at scale %.2f", cursor_theme->scale);
+		wl_list_remove(&cursor_theme->link);
+		free(cursor_theme);
+	} else {
+		cursor_theme->theme = cursor_task->theme;
+	}
+	free(cursor_task->name);
+	free(cursor_task);
+}
+
+/* Loads the cursor theme at the scale of an output on the worker pool, unless it is cached
+   already. Scale 1 is loaded by the cursor manager when kwm starts, so there always is a
+   cursor to show */
+void cursor_theme_load(struct kwm_server *server, float scale) {
+	if (scale == 1) {
+		return;
+	}
+	struct kwm_cursor_theme *cursor_theme;
+	wl_list_for_each(cursor_theme, &server->cursor_themes, link) {
+		if (cursor_theme->scale == scale) {
+			return;
+		}
+	}
+	cursor_theme = calloc(1, sizeof(struct kwm_cursor_theme));
+	struct kwm_cursor_task *cursor_task = calloc(1, sizeof(struct kwm_cursor_task));
+	if (cursor_theme == NULL || cursor_task == NULL) {
+		free(cursor_theme);
+		free(cursor_task);
+		return;
+	}
+	cursor_theme->scale = scale;
+	wl_list_insert(&server->cursor_themes, &cursor_theme->link);
+
+	struct wlr_xcursor_manager *manager = server->cursor_mgr;
+	cursor_task->server = server;
+	cursor_task->cursor_theme = cursor_theme;
+	cursor_task->name = manager->name != NULL ? strdup(manager->name) : NULL;
+	cursor_task->size = manager->size;
+	cursor_task->task.name = "cursor theme";
+	cursor_task->task.run = cursor_task_run;
+	cursor_task->task.done = cursor_task_done;
+	pool_submit(&server->pool, &cursor_task->task);
+}
+
+/* Sets the cursor image on every output. The cursor manager covers outputs at scale 1, the
+   cached themes those at their scale */
+void cursor_set_image(struct kwm_server *server, const char *name) {
+	wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, name, server->cursor);
+	struct kwm_cursor_theme *cursor_theme;
+	wl_list_for_each(cursor_theme, &server->cursor_themes, link) {
+		struct wlr_xcursor *xcursor = cursor_theme->theme != NULL
+			? wlr_xcursor_theme_get_cursor(cursor_theme->theme, name)
+			: NULL;
+		if (xcursor == NULL) {
+			continue;
+		}
+		struct wlr_xcursor_image *image = xcursor->images[0];
+		wlr_cursor_set_image(server->cursor, image->buffer, image->width * 4, image->width,
+							 image->height, image->hotspot_x, image->hotspot_y,
+							 cursor_theme->scale);
+	}
 }
 
 /* This function sets up an interactive move or resize operation, where the compositor
    stops propgating pointer events to clients and instead consumes them itself */
 void begin_interactive(struct kwm_view *view, enum kwm_cursor_mode mode, uint32_t edges) {
+	if (view == NULL) {
+		return;
+	}
 	struct kwm_server *server = view->server;
 	struct wlr_surface *focused_surface = server->seat->pointer_state.focused_surface;
-	if (view->xdg_surface->surface != focused_surface) {
+	if (view_surface(view) != focused_surface) {
 		/* Deny move/resize requests from unfocused clients */
 		return;
 	}
 
 	server->grabbed_view = view;
-	server->grabbed_view_workspace = NULL;
 	server->cursor_mode = mode;
 	struct wlr_box geo_box;
-	wlr_xdg_surface_get_geometry(view->xdg_surface, &geo_box);
+	view_get_geometry(view, &geo_box);
 	if (mode == KWM_CURSOR_MOVE) {
 		server->grab_x = server->cursor->x - view->x;
 		server->grab_y = server->cursor->y - view->y;
 	} else {
-		server->grab_x = server->cursor->x + geo_box.x;
-		server->grab_y = server->cursor->y + geo_box.y;
+		server->grab_x = server->cursor->x;
+		server->grab_y = server->cursor->y;
 	}
 	server->grab_width = geo_box.width;
 	server->grab_height = geo_box.height;
 	server->resize_edges = edges;
+
+	if (mode == KWM_CURSOR_RESIZE) {
+		/* Remember where the view was, the edges that are not grabbed stay in place */
+		view->resize_grab.x = view->x + geo_box.x;
+		view->resize_grab.y = view->y + geo_box.y;
+		view->resize_grab.width = geo_box.width;
+		view->resize_grab.height = geo_box.height;
+		view->resize_edges = edges;
+		view->resize_width = view->configured_width = geo_box.width;
+		view->resize_height = view->configured_height = geo_box.height;
+		view->resizing = view->resize_grabbed = true;
+		if (view->type == KWM_VIEW_XDG && view->resize_serial == 0) {
+			view->resize_serial = wlr_xdg_toplevel_set_resizing(view->xdg_surface, true);
+		}
+	}
+}
+
+/* This function ends an interactive move or resize. A resized view keeps stretching its
+   buffer until the client committed the final size. An unmapped view is not configured
+   anymore, its surface may already be on its way out */
+void end_interactive(struct kwm_server *server) {
+	struct kwm_view *view = server->grabbed_view;
+	if (server->cursor_mode == KWM_CURSOR_RESIZE && view != NULL) {
+		view->resize_grabbed = false;
+		if (view->mapped) {
+			view_flush_resize(view);
+		}
+	}
+	server->cursor_mode = KWM_CURSOR_PASSTHROUGH;
+	server->grabbed_view = NULL;
+}
+
+/* Allocates a view on the shown tags of the output under the cursor. The caller
+   attaches the shell surface, the view is shown once that surface is mapped */
+struct kwm_view *view_create(struct kwm_server *server, enum kwm_view_type type) {
+	struct kwm_output *output = output_at_cursor(server);
+	if (output == NULL && !wl_list_empty(&server->outputs)) {
+		output = wl_container_of(server->outputs.next, output, link);
+	}
+	if (output == NULL) {
+		wlr_log(WLR_ERROR, "No output to place the new view on");
+		return NULL;
+	}
+
+	struct kwm_view *view = calloc(1, sizeof(struct kwm_view));
+	if (view == NULL) {
+		return NULL;
+	}
+	view->type = type;
+	view->server = server;
+
+	/* Add the view to the scene. It is shown once the surface is mapped */
+	wl_list_insert(output->views.prev, &view->link);
+	wl_list_insert(output->focus_stack.prev, &view->focus_link);
+	view->output = output;
+	view->tags = output->tags;
+	view->scene_tree = scene_tree_create(output->scene_tree);
+	view->scene_tree->tags = view->tags;
+	view->scene_tree->data = view;
+	view->scene_tree->enabled = false;
+	for (int i = 0; i < 4; i++) {
+		view->borders[i] = scene_rect_create(view->scene_tree, 0, 0, border_color);
+		view->borders[i]->node.enabled = false;
+	}
+	return view;
+}
+
+/* Frees a view once its shell surface is gone. The caller removes its own listeners */
+void view_destroy(struct kwm_view *view) {
+	struct kwm_server *server = view->server;
+	if (server->grabbed_view == view) {
+		end_interactive(server);
+	}
+	if (server->focused_view == view) {
+		server->focused_view = NULL;
+		state_mark_dirty(&server->state);
+	}
+	wl_list_remove(&view->link);
+	wl_list_remove(&view->focus_link);
+	scene_node_destroy(view->scene_tree);
+	free(view);
+}
+
+/* Shows a view and gives it the keyboard focus */
+void view_map(struct kwm_view *view) {
+	/* All X windows belong to the Xwayland client, so rules only apply to xdg toplevels */
+	if (view->type == KWM_VIEW_XDG) {
+		struct kwm_client *client = client_from_surface(view->server, view_surface(view));
+		client_apply_rules(client, view->xdg_surface->toplevel->app_id);
+	}
+
+	view->mapped = true;
+	scene_node_set_enabled(view->scene_tree, true);
+	view_update_borders(view);
+	view_raise(view);
+	if (!view_is_visible(view) ||
+		(view->type == KWM_VIEW_XWAYLAND && view->xwayland_surface->override_redirect)) {
+		return;
+	}
+	focus_view(view, view_surface(view));
+}
+
+/* Hides a view. The focus goes back to the view of its output focused before it */
+void view_unmap(struct kwm_view *view) {
+	struct kwm_server *server = view->server;
+	view->mapped = false;
+	scene_node_set_enabled(view->scene_tree, false);
+	if (server->focused_view == view) {
+		server->focused_view = NULL;
+		state_mark_dirty(&server->state);
+		if (view->output != NULL) {
+			output_refocus(view->output);
+		}
+	}
+}
+
+/* Returns the main wlr_surface of a view */
+struct wlr_surface *view_surface(struct kwm_view *view) {
+	switch (view->type) {
+	case KWM_VIEW_XDG:
+		return view->xdg_surface->surface;
+	case KWM_VIEW_XWAYLAND:
+		return view->xwayland_surface->surface;
+	}
+	return NULL;
+}
+
+/* Returns the window geometry of a view, relative to its surface. X windows have no
+   client side decorations, their geometry is the whole surface */
+void view_get_geometry(struct kwm_view *view, struct wlr_box *box) {
+	if (view->type == KWM_VIEW_XDG) {
+		wlr_xdg_surface_get_geometry(view->xdg_surface, box);
+		return;
+	}
+	struct wlr_surface *surface = view_surface(view);
+	box->x = box->y = 0;
+	box->width = box->height = 0;
+	if (surface != NULL) {
+		surface_get_size(surface, &box->width, &box->height);
+	}
+}
+
+/* Tells the client whether its view is the focused one */
+void view_set_activated(struct kwm_view *view, bool activated) {
+	if (view->activated == activated) {
+		return;
+	}
+	view->activated = activated;
+	if (view->type == KWM_VIEW_XDG) {
+		wlr_xdg_toplevel_set_activated(view->xdg_surface, activated);
+	} else {
+		wlr_xwayland_surface_activate(view->xwayland_surface, activated);
+	}
+	view_update_borders(view);
+}
+
+/* Puts a view on top of the others of its output. Only the view is damaged */
+void view_raise(struct kwm_view *view) {
+	struct wl_list *views =
+		view->output != NULL ? &view->output->views : &view->server->parked_views;
+	if (views->prev == &view->link) {
+		return;
+	}
+	wl_list_remove(&view->link);
+	wl_list_insert(views->prev, &view->link);
+	scene_node_raise_to_top(view->scene_tree);
+}
+
+/* Checks whether a view is mapped and tagged with a tag its output shows */
+bool view_is_visible(struct kwm_view *view) {
+	return view->mapped && view->output != NULL && (view->tags & view->output->tags) != 0;
+}
+
+/* This function puts a view on other tags. Only the view is damaged, and the focus moves on
+   when the view got hidden */
+void view_set_tags(struct kwm_view *view, uint32_t tags) {
+	if (tags == 0 || tags == view->tags) {
+		return;
+	}
+	view->tags = tags;
+	scene_node_set_tags(view->scene_tree, tags);
+	if (view->server->focused_view == view) {
+		state_mark_dirty(&view->server->state);
+		if (view->output != NULL && !view_is_visible(view)) {
+			output_refocus(view->output);
+		}
+	}
+}
+
+/* This function is called when a view changes its title. Only the focused one is published */
+void handle_view_set_title(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, set_title);
+	if (view->server->focused_view == view) {
+		state_mark_dirty(&view->server->state);
+	}
+}
+
+/* This function is called when a view changes its app_id, or its class for X windows */
+void handle_view_set_app_id(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, set_app_id);
+	if (view->server->focused_view == view) {
+		state_mark_dirty(&view->server->state);
+	}
 }
 
 /* This function is called when a client would like to begin an interactive move. */
@@ -564,6 +1231,22 @@ void handle_xdg_toplevel_request_move(struct wl_listener *listener, void *data)
 	begin_interactive(view, KWM_CURSOR_MOVE, 0);
 }
 
+/* Moves a resize along after the client committed. Once the outstanding configure is acked
+   the next size is sent, and the resize is over when the client caught up after the grab */
+void view_resize_commit(struct kwm_view *view, bool acked) {
+	if (!view->resizing) {
+		return;
+	}
+	if (view->resize_serial != 0 && acked) {
+		view->resize_serial = 0;
+		view_flush_resize(view);
+	}
+	if (!view->resize_grabbed && view->resize_serial == 0) {
+		view->resizing = false;
+	}
+	view_apply_resize(view);
+}
+
 /* This function is called when a client would like to resize their window */
 void handle_xdg_toplevel_request_resize(struct wl_listener *listener, void *data) {
 	struct kwm_view *view = wl_container_of(listener, view, request_resize);
@@ -571,25 +1254,39 @@ void handle_xdg_toplevel_request_resize(struct wl_listener *listener, void *data
 	begin_interactive(view, KWM_CURSOR_RESIZE, event->edges);
 }
 
+/* This function is called whenever the surface of a view commits new state. The scene
+   tracks the surfaces by itself, the view only updates its decorations */
+void handle_xdg_surface_commit(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, commit);
+
+	view_resize_commit(view, view->xdg_surface->configure_serial >= view->resize_serial);
+	view_update_borders(view);
+}
+
 /* This function is called when a surface is mapped, or ready to display on-screen */
 void handle_xdg_surface_map(struct wl_listener *listener, void *data) {
 	struct kwm_view *view = wl_container_of(listener, view, map);
-
-	view->mapped = true;
-	focus_view(view, view->xdg_surface->surface);
+	view_map(view);
 }
 
 /* This function is called when a surface is unmapped, and should no longer be shown */
 void handle_xdg_surface_unmap(struct wl_listener *listener, void *data) {
 	struct kwm_view *view = wl_container_of(listener, view, unmap);
-	view->mapped = false;
+	view_unmap(view);
 }
 
 /* This function is called when the surface is destroyed and should never be shown again. */
 void handle_xdg_surface_destroy(struct wl_listener *listener, void *data) {
 	struct kwm_view *view = wl_container_of(listener, view, destroy);
-	wl_list_remove(&view->link);
-	free(view);
+	wl_list_remove(&view->commit.link);
+	wl_list_remove(&view->map.link);
+	wl_list_remove(&view->unmap.link);
+	wl_list_remove(&view->destroy.link);
+	wl_list_remove(&view->request_move.link);
+	wl_list_remove(&view->request_resize.link);
+	wl_list_remove(&view->set_title.link);
+	wl_list_remove(&view->set_app_id.link);
+	view_destroy(view);
 }
 
 /* This function handles the XDG view decoration */
@@ -614,16 +1311,19 @@ void handle_new_xdg_surface(struct wl_listener *listener, void *data) {
 	wlr_log(WLR_DEBUG, "New xdg_shell toplevel title='%s' app_id='%s'",
 			xdg_surface->toplevel->title, xdg_surface->toplevel->app_id);
 
-	struct wlr_output *wlr_output =
-		wlr_output_layout_output_at(server->output_layout, server->cursor->x, server->cursor->y);
-	struct kwm_output *output = wlr_output->data;
-
 	/* Allocate a view for this surface */
-	struct kwm_view *view = calloc(1, sizeof(struct kwm_view));
-	view->server = server;
+	struct kwm_view *view = view_create(server, KWM_VIEW_XDG);
+	if (view == NULL) {
+		return;
+	}
 	view->xdg_surface = xdg_surface;
+	struct kwm_scene_node *xdg_tree = scene_xdg_surface_create(view->scene_tree, xdg_surface);
+	view->surface_node = scene_xdg_surface_get_surface(xdg_tree);
 
 	/* Listen to the various events it can emit */
+	view->commit.notify = handle_xdg_surface_commit;
+	wl_signal_add(&xdg_surface->surface->events.commit, &view->commit);
+
 	view->map.notify = handle_xdg_surface_map;
 	wl_signal_add(&xdg_surface->events.map, &view->map);
 
@@ -641,9 +1341,11 @@ void handle_new_xdg_surface(struct wl_listener *listener, void *data) {
 	view->request_resize.notify = handle_xdg_toplevel_request_resize;
 	wl_signal_add(&toplevel->events.request_resize, &view->request_resize);
 
-	/* Add it to the list of views */
-	// wl_list_insert(&server->views, &view->link);
-	wl_list_insert(&output->active_workspace->views, &view->link);
+	view->set_title.notify = handle_view_set_title;
+	wl_signal_add(&toplevel->events.set_title, &view->set_title);
+
+	view->set_app_id.notify = handle_view_set_app_id;
+	wl_signal_add(&toplevel->events.set_app_id, &view->set_app_id);
 }
 
 bool server_init(struct kwm_server *server) {
@@ -652,25 +1354,49 @@ bool server_init(struct kwm_server *server) {
 	/* The wayland display handles accepting clients from the Unix socket as well as
 	   managing wayland globals etc */
 	server->display = wl_display_create();
+	if (!clock_init(&server->clock, server)) {
+		return false;
+	}
 
-	/* The backend abstracts input and output hardware. The autocreate will choose the most
-	   suitable backend based on the current environment. */
-	server->backend = wlr_backend_autocreate(server->display, NULL);
+	/* Workers take the slow loading off the main loop */
+	if (!pool_init(&server->pool, server->display)) {
+		return false;
+	}
+
+	/* The backend abstracts input and output hardware. The most suitable backend is chosen
+	   based on the current environment, see loop_create_backend */
+	server->backend = loop_create_backend(&server->loop, server->display);
+	if (server->backend == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create the backend");
+		return false;
+	}
 
 	server->renderer = wlr_backend_get_renderer(server->backend);
 	wlr_renderer_init_wl_display(server->renderer, server->display);
 
 	/* This creates some hands-off wlroots interfaces. The compositor is necessary for
 	   clients to allocate surfaces and the data device manager handles the clipboard */
-	wlr_compositor_create(server->display, server->renderer);
+	server->compositor = wlr_compositor_create(server->display, server->renderer);
 	wlr_data_device_manager_create(server->display);
 
+	/* Keep track of what each client costs, see client_dump_stats */
+	client_accounting_init(server);
+
+	/* Viewports and fractional scales let clients draw at the physical size of the output */
+	hidpi_init(server);
+
 	/* Output Layout is a wlroots utility for working with an arrangment of screens
 	   in a physical layout */
 	server->output_layout = wlr_output_layout_create();
 
+	/* The scene holds everything that is shown on the outputs. It is updated as surfaces
+	   commit and views change, and is used for both rendering and hit-testing */
+	server->scene = scene_create(server->output_layout, server->renderer);
+
 	/* Configure a listener to be notified when new outputs are available on the backend */
 	wl_list_init(&server->outputs);
+	wl_list_init(&server->parked_views);
+	wl_list_init(&server->parked_focus);
 	server->new_output.notify = handle_new_output;
 	wl_signal_add(&server->backend->events.new_output, &server->new_output);
 
@@ -687,6 +1413,7 @@ bool server_init(struct kwm_server *server) {
 	/* Creates an xcursor manager which loads up xcursor themes to source cursor images */
 	server->cursor_mgr = wlr_xcursor_manager_create(NULL, 24);
 	wlr_xcursor_manager_load(server->cursor_mgr, 1);
+	wl_list_init(&server->cursor_themes);
 
 	/* wlr_cursor only displays an image on the screen. It does not move around automatically.
 	   So we will need to attach input devices and handle movement */
@@ -716,6 +1443,14 @@ bool server_init(struct kwm_server *server) {
 	server->request_set_cursor.notify = handle_request_set_cursor;
 	wl_signal_add(&server->seat->events.request_set_cursor, &server->request_set_cursor);
 
+	/* Reserve the X display. Xwayland itself is only started once an X client connects */
+	if (!xwayland_init(&server->xwayland, server)) {
+		wlr_log(WLR_ERROR, "Failed to set up Xwayland, X clients are not supported");
+	}
+
+	/* Stop compositing, and later power down the outputs, when nobody is around */
+	idle_init(&server->idle, server);
+
 	/* Set up the decoration manager */
 	server->decoration_mgr = wlr_server_decoration_manager_create(server->display);
 	wlr_server_decoration_manager_set_default_mode(server->decoration_mgr,
@@ -733,6 +1468,9 @@ bool server_init(struct kwm_server *server) {
 		wlr_backend_destroy(server->backend);
 		return false;
 	}
+
+	/* Status bars read the state from a shared page rather than asking over the socket */
+	state_init(&server->state, server);
 	return true;
 }
 
@@ -750,11 +1488,29 @@ bool server_start(struct kwm_server *server) {
 void server_run(struct kwm_server *server) {
 	/* Run the wayland event loop */
 	wlr_log(WLR_INFO, "Running compositor on WAYLAND_DISPLAY=%s", server->socket);
-	wl_display_run(server->display);
+	loop_run(&server->loop);
 }
 
 void server_cleanup(struct kwm_server *server) {
+	pool_finish(&server->pool);
+	/* No theme is loaded on the pool anymore */
+	struct kwm_cursor_theme *cursor_theme, *tmp;
+	wl_list_for_each_safe(cursor_theme, tmp, &server->cursor_themes, link) {
+		if (cursor_theme->theme != NULL) {
+			wlr_xcursor_theme_destroy(cursor_theme->theme);
+		}
+		wl_list_remove(&cursor_theme->link);
+		free(cursor_theme);
+	}
+	xwayland_finish(&server->xwayland);
+	client_accounting_finish(server);
+	idle_finish(&server->idle);
+	state_finish(&server->state);
+	clock_finish(&server->clock);
 	wl_display_destroy_clients(server->display);
+	/* The outputs are torn down while the scene is still there */
+	wlr_backend_destroy(server->backend);
+	scene_destroy(server->scene);
 	wl_display_destroy(server->display);
-	// wlr_backend_destroy(server->backend);
+	loop_finish(&server->loop);
 }
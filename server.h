@@ -1,12 +1,23 @@
 #ifndef KWM_SERVER_H
 #define KWM_SERVER_H
 
+#include "client.h"
+#include "clock.h"
+#include "hidpi.h"
+#include "idle.h"
+#include "loop.h"
+#include "pool.h"
+#include "raster.h"
+#include "scene.h"
+#include "state.h"
+#include "xwayland.h"
 #include <wayland-server.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
 #include <wlr/types/wlr_seat.h>
@@ -15,11 +26,21 @@
 #include <wlr/types/wlr_xdg_decoration_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
 
+/* Number of tags views can be put on, dwm-style */
+#define KWM_TAGS 9
+#define KWM_TAGMASK ((1u << KWM_TAGS) - 1)
+
 enum kwm_cursor_mode { KWM_CURSOR_PASSTHROUGH, KWM_CURSOR_MOVE, KWM_CURSOR_RESIZE };
 
+enum kwm_view_type { KWM_VIEW_XDG, KWM_VIEW_XWAYLAND };
+
 /* This is the main kwm server struct */
 struct kwm_server {
 	struct wl_display *display;
+	struct kwm_clock clock;
+	struct kwm_loop loop;
+	struct kwm_pool pool;
+	struct kwm_state state;
 	struct wlr_backend *backend;
 	struct wlr_renderer *renderer;
 	struct wlr_compositor *compositor;
@@ -27,11 +48,16 @@ struct kwm_server {
 	struct wlr_xdg_shell *xdg_shell;
 	struct wlr_cursor *cursor;
 	struct wlr_xcursor_manager *cursor_mgr;
+	/* Cursor themes at the scales of the outputs other than 1 */
+	struct wl_list cursor_themes;
 	struct wlr_seat *seat;
 	struct wlr_server_decoration_manager *decoration_mgr;
 	struct wlr_xdg_decoration_manager_v1 *xdg_decoration_mgr;
+	struct kwm_scene *scene;
+	struct kwm_xwayland xwayland;
+	struct kwm_idle idle;
+	struct kwm_view *focused_view;
 	struct kwm_view *grabbed_view;
-	struct kwm_workspace *grabbed_view_workspace;
 	double grab_x, grab_y;
 	int grab_width, grab_height;
 	uint32_t resize_edges;
@@ -39,8 +65,15 @@ struct kwm_server {
 	const char *socket;
 
 	struct wl_list outputs;
+	/* Views left without an output when the last one was detached, relative to the layout
+	   origin, along with their focus order. The next output attached adopts them */
+	struct wl_list parked_views;
+	struct wl_list parked_focus;
 	struct wl_list keyboards;
+	struct wl_list clients;
+	struct wl_event_source *sigusr1;
 
+	struct wl_listener new_surface;
 	struct wl_listener new_xdg_surface;
 	struct wl_listener new_xdg_decoration;
 	struct wl_listener new_output;
@@ -56,31 +89,92 @@ struct kwm_server {
 /* This struct holds the state for the connected outputs (displays) */
 struct kwm_output {
 	struct wlr_output *wlr_output;
+	struct wlr_output_damage *damage;
 	struct kwm_server *server;
+	struct kwm_scene_node *scene_tree;
 	struct timespec last_frame;
 
 	struct wl_list link;
 	struct wl_listener destroy;
 	struct wl_listener frame;
 
-	struct kwm_workspace *active_workspace;
-	struct wl_list workspaces;
+	/* Tags shown on the output */
+	uint32_t tags;
+	/* Views placed on the output, from bottom to top. Rendering and hit-testing test the tags
+	   of each view against those of the output, so showing other tags redraws no view */
+	struct wl_list views;
+	/* The same views, most recently focused first. The views of a tag keep their order when
+	   other tags are shown, so switching back focuses the view last used there */
+	struct wl_list focus_stack;
+
+	/* Framebuffer of the software renderer */
+	struct kwm_raster raster;
+
+	/* Refreshes on the virtual clock, the next one in nanoseconds of virtual time */
+	struct kwm_timer *vsync;
+	int64_t vsync_ns;
+
+	/* Set when a tag switch is waiting to be presented */
+	bool switch_pending;
+	struct timespec switch_start;
+
+	/* Frame statistics published in the state page */
+	uint64_t frames;
+	uint64_t last_frame_ns;
+	uint32_t render_us, render_us_avg;
 };
 
 /* This struct holds the state of a view (application) */
 struct kwm_view {
+	enum kwm_view_type type;
 	struct kwm_server *server;
-	struct wl_list link;
-	struct wlr_xdg_surface *xdg_surface;
+	union {
+		struct wlr_xdg_surface *xdg_surface;
+		struct wlr_xwayland_surface *xwayland_surface;
+	};
 	struct wlr_xdg_toplevel_decoration_v1 *xdg_decoration;
+	struct kwm_output *output;
+	/* Links in the views and the focus stack of the output */
+	struct wl_list link;
+	struct wl_list focus_link;
+	uint32_t tags;
+	struct kwm_scene_node *scene_tree;
+	struct kwm_scene_surface *surface_node;
+	struct kwm_scene_rect *borders[4];
 	bool mapped;
+	bool activated;
 	int x, y;
 
+	/* Interactive resize. Pointer motion only updates the requested size and at most one
+	   configure is outstanding. The view keeps resizing until the client caught up */
+	bool resizing;
+	bool resize_grabbed;
+	/* Serial of the outstanding configure, X windows have no serials and use 1 */
+	uint32_t resize_serial;
+	uint32_t resize_edges;
+	struct wlr_box resize_grab;
+	int resize_width, resize_height;
+	int configured_width, configured_height;
+
+	struct wl_listener commit;
 	struct wl_listener map;
 	struct wl_listener unmap;
 	struct wl_listener destroy;
 	struct wl_listener request_move;
 	struct wl_listener request_resize;
+	struct wl_listener request_configure;
+	struct wl_listener set_title;
+	struct wl_listener set_app_id;
+	struct wl_listener surface_destroy;
+};
+
+struct kwm_keymap_task;
+
+/* A cursor theme at the scale of an output. The theme is NULL while the worker pool loads it */
+struct kwm_cursor_theme {
+	struct wl_list link;
+	float scale;
+	struct wlr_xcursor_theme *theme;
 };
 
 /* This struct holds the state of a keyboard */
@@ -88,23 +182,12 @@ struct kwm_keyboard {
 	struct wl_list link;
 	struct kwm_server *server;
 	struct wlr_input_device *device;
+	/* Set while the keymap is compiled, the keyboard is set up once it is ready */
+	struct kwm_keymap_task *keymap_task;
 
 	struct wl_listener modifiers;
 	struct wl_listener key;
-};
-
-struct kwm_workspace {
-	struct wl_list link;
-
-	struct kwm_output *output;
-	struct wl_list views;
-};
-
-struct render_data {
-	struct wlr_output *output;
-	struct wlr_renderer *renderer;
-	struct kwm_view *view;
-	struct timespec *when;
+	struct wl_listener destroy;
 };
 
 bool server_init(struct kwm_server *server);
@@ -112,7 +195,25 @@ bool server_start(struct kwm_server *server);
 void server_run(struct kwm_server *server);
 void server_cleanup(struct kwm_server *server);
 
-void render_surface(struct wlr_surface *surface, int sx, int sy, void *data);
+struct kwm_output *output_at_cursor(struct kwm_server *server);
+void output_set_tags(struct kwm_output *output, uint32_t tags);
+void output_focus_next(struct kwm_output *output);
+
+struct kwm_view *view_create(struct kwm_server *server, enum kwm_view_type type);
+void view_destroy(struct kwm_view *view);
+void view_map(struct kwm_view *view);
+void view_unmap(struct kwm_view *view);
+struct wlr_surface *view_surface(struct kwm_view *view);
+void view_get_geometry(struct kwm_view *view, struct wlr_box *box);
+void view_set_activated(struct kwm_view *view, bool activated);
+void view_raise(struct kwm_view *view);
+void view_update_borders(struct kwm_view *view);
+bool view_is_visible(struct kwm_view *view);
+void view_set_tags(struct kwm_view *view, uint32_t tags);
+void view_resize_commit(struct kwm_view *view, bool acked);
+
+struct kwm_view *desktop_view_at(struct kwm_server *server, double lx, double ly,
+								 struct wlr_surface **surface, double *sx, double *sy);
 void focus_view(struct kwm_view *view, struct wlr_surface *surface);
 void process_cursor_motion(struct kwm_server *server, uint32_t time);
 void process_cursor_move(struct kwm_server *server, uint32_t time);
@@ -121,13 +222,17 @@ void process_cursor_resize(struct kwm_server *server, uint32_t time);
 void handle_output_frame(struct wl_listener *listener, void *data);
 void handle_new_output(struct wl_listener *listener, void *data);
 void handle_output_destroy(struct wl_listener *listener, void *data);
+bool server_driver_command(struct kwm_server *server, const char *command);
 void handle_new_xdg_surface(struct wl_listener *listener, void *data);
+void handle_xdg_surface_commit(struct wl_listener *listener, void *data);
 void handle_xdg_surface_map(struct wl_listener *listener, void *data);
 void handle_xdg_surface_unmap(struct wl_listener *listener, void *data);
 void handle_xdg_surface_destroy(struct wl_listener *listener, void *data);
 void handle_xdg_decoration(struct wl_listener *listener, void *data);
 void handle_xdg_toplevel_request_move(struct wl_listener *listener, void *data);
 void handle_xdg_toplevel_request_resize(struct wl_listener *listener, void *data);
+void handle_view_set_title(struct wl_listener *listener, void *data);
+void handle_view_set_app_id(struct wl_listener *listener, void *data);
 void handle_cursor_motion(struct wl_listener *listener, void *data);
 void handle_cursor_motion_abs(struct wl_listener *listener, void *data);
 void handle_cursor_button(struct wl_listener *listener, void *data);
@@ -140,6 +245,9 @@ void handle_keyboard_key(struct wl_listener *listener, void *data);
 
 void add_new_pointer(struct kwm_server *server, struct wlr_input_device *device);
 void add_new_keyboard(struct kwm_server *server, struct wlr_input_device *device);
+void cursor_theme_load(struct kwm_server *server, float scale);
+void cursor_set_image(struct kwm_server *server, const char *name);
 
 void begin_interactive(struct kwm_view *view, enum kwm_cursor_mode mode, uint32_t edges);
+void end_interactive(struct kwm_server *server);
 #endif
@@ -0,0 +1,188 @@
+#include "state.h"
+#include "server.h"
+#include "kwm.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+/* Returns the frame interval of the fastest output in milliseconds */
+static int state_frame_interval(struct kwm_server *server) {
+	int refresh = 0;
+	struct kwm_output *output;
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->wlr_output->refresh > refresh) {
+			refresh = output->wlr_output->refresh;
+		}
+	}
+	/* The refresh rate is in mHz, 0 when unknown */
+	int interval = refresh > 0 ? 1000000 / refresh : 16;
+	return interval > 0 ? interval : 1;
+}
+
+static int handle_state_timer(void *data) {
+	state_publish(data);
+	return 0;
+}
+
+static void copy_string(char *dst, size_t size, const char *src) {
+	snprintf(dst, size, "%s", src != NULL ? src : "");
+}
+
+/* Fills in the published state of an output */
+static void state_fill_output(struct kwm_state_output *out, struct kwm_output *output) {
+	struct kwm_server *server = output->server;
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct wlr_box *box = wlr_output_layout_get_box(server->output_layout, wlr_output);
+
+	copy_string(out->name, sizeof(out->name), wlr_output->name);
+	out->x = box != NULL ? box->x : 0;
+	out->y = box != NULL ? box->y : 0;
+	out->width = wlr_output->width;
+	out->height = wlr_output->height;
+	out->scale = wlr_output->scale;
+	out->tags = output->tags;
+	out->focused = server->focused_view != NULL && server->focused_view->output == output;
+	out->frames = output->frames;
+	out->last_frame_ns = output->last_frame_ns;
+	out->render_us = output->render_us;
+	out->render_us_avg = output->render_us_avg;
+}
+
+/* This function creates the state page next to the Wayland socket. kwm runs without it when
+   it cannot be created */
+bool state_init(struct kwm_state *state, struct kwm_server *server) {
+	state->server = server;
+	state->fd = -1;
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL || server->socket == NULL) {
+		wlr_log(WLR_ERROR, "No XDG_RUNTIME_DIR, kwm does not publish its state");
+		return false;
+	}
+	snprintf(state->path, sizeof(state->path), "%s/%s.state", dir, server->socket);
+
+	state->fd = open(state->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (state->fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create %s", state->path);
+		return false;
+	}
+	if (ftruncate(state->fd, sizeof(struct kwm_state_page)) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to size %s", state->path);
+		state_finish(state);
+		return false;
+	}
+	state->page = mmap(NULL, sizeof(struct kwm_state_page), PROT_READ | PROT_WRITE, MAP_SHARED,
+					   state->fd, 0);
+	if (state->page == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "Failed to map %s", state->path);
+		state->page = NULL;
+		state_finish(state);
+		return false;
+	}
+	state->timer = clock_add_timer(&server->clock, handle_state_timer, state);
+
+	state->page->magic = KWM_STATE_MAGIC;
+	state->page->version = KWM_STATE_VERSION;
+	state_publish(state);
+	wlr_log(WLR_INFO, "Publishing the state in %s", state->path);
+	return true;
+}
+
+void state_finish(struct kwm_state *state) {
+	if (state->timer != NULL) {
+		clock_timer_remove(state->timer);
+		state->timer = NULL;
+	}
+	if (state->page != NULL) {
+		munmap(state->page, sizeof(struct kwm_state_page));
+		state->page = NULL;
+	}
+	if (state->fd >= 0) {
+		unlink(state->path);
+		close(state->fd);
+		state->fd = -1;
+	}
+}
+
+/* This function is called when the published state changed. The page is written with the
+   next frame, or after a frame interval when nothing is drawn until then */
+void state_mark_dirty(struct kwm_state *state) {
+	if (state->dirty || state->page == NULL) {
+		return;
+	}
+	state->dirty = true;
+	if (!state->stats_pending && state->timer != NULL) {
+		clock_timer_update(state->timer, state_frame_interval(state->server));
+	}
+}
+
+/* This function is called when an output showed a frame. Pending changes are written with
+   it. The frame statistics changed as well, but they only arm the timer, so that outputs
+   presenting one after the other do not each write the page */
+void state_frame(struct kwm_state *state) {
+	if (state->page == NULL) {
+		return;
+	}
+	if (state->dirty) {
+		state_publish(state);
+		return;
+	}
+	if (!state->stats_pending && state->timer != NULL) {
+		state->stats_pending = true;
+		clock_timer_update(state->timer, state_frame_interval(state->server));
+	}
+}
+
+/* Writes the state page under the seqlock. The new state is gathered beforehand, so the page
+   is only inconsistent for the time of a copy */
+void state_publish(struct kwm_state *state) {
+	if (state->page == NULL) {
+		return;
+	}
+	struct kwm_server *server = state->server;
+	struct kwm_state_page *shadow = &state->shadow;
+	memset(shadow, 0, sizeof(*shadow));
+
+	struct timespec now;
+	clock_now(&server->clock, &now);
+	shadow->published_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+	struct kwm_output *output;
+	wl_list_for_each(output, &server->outputs, link) {
+		if (shadow->num_outputs == KWM_STATE_OUTPUTS) {
+			break;
+		}
+		state_fill_output(&shadow->outputs[shadow->num_outputs++], output);
+	}
+
+	struct kwm_view *view = server->focused_view;
+	if (view != NULL && view->type == KWM_VIEW_XDG) {
+		copy_string(shadow->title, sizeof(shadow->title), view->xdg_surface->toplevel->title);
+		copy_string(shadow->app_id, sizeof(shadow->app_id), view->xdg_surface->toplevel->app_id);
+	} else if (view != NULL) {
+		copy_string(shadow->title, sizeof(shadow->title), view->xwayland_surface->title);
+		copy_string(shadow->app_id, sizeof(shadow->app_id), view->xwayland_surface->class);
+	}
+	if (view != NULL) {
+		shadow->focused_tags = view->tags;
+	}
+
+	/* Everything after seq is copied while seq is odd */
+	struct kwm_state_page *page = state->page;
+	size_t offset = offsetof(struct kwm_state_page, num_outputs);
+	uint32_t seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+	atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy((char *)page + offset, (char *)shadow + offset, sizeof(*page) - offset);
+	atomic_store_explicit(&page->seq, seq + 2, memory_order_release);
+
+	if ((state->dirty || state->stats_pending) && state->timer != NULL) {
+		clock_timer_update(state->timer, 0);
+	}
+	state->dirty = false;
+	state->stats_pending = false;
+}
@@ -0,0 +1,80 @@
+#ifndef KWM_STATE_H
+#define KWM_STATE_H
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KWM_STATE_MAGIC 0x736d776b
+#define KWM_STATE_VERSION 1
+#define KWM_STATE_OUTPUTS 8
+
+/* The state of an output as published in the state page */
+struct kwm_state_output {
+	char name[32];
+	int32_t x, y, width, height;
+	float scale;
+	/* Tags the output shows */
+	uint32_t tags;
+	uint32_t focused;
+
+	/* Frames shown so far, when the last one was shown on the kwm clock, and how long the
+	   last frame took to render along with a moving average */
+	uint64_t frames;
+	uint64_t last_frame_ns;
+	uint32_t render_us;
+	uint32_t render_us_avg;
+};
+
+/* The state page kwm publishes at the path in KWM_STATE. Readers map it read-only and poll
+   it without talking to kwm. seq is odd while kwm writes the page, a reader copies the page
+   and retries when seq was odd or changed in the meantime:
+
+	do {
+		seq = atomic_load_explicit(&page->seq, memory_order_acquire);
+		memcpy(&copy, page, sizeof(copy));
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != atomic_load_explicit(&page->seq, memory_order_relaxed));
+*/
+struct kwm_state_page {
+	uint32_t magic;
+	uint32_t version;
+	_Atomic uint32_t seq;
+	uint32_t num_outputs;
+	/* When kwm last wrote the page, on the kwm clock */
+	uint64_t published_ns;
+
+	/* The focused view, its output is the one with focused set */
+	char title[256];
+	char app_id[128];
+	uint32_t focused_tags;
+
+	struct kwm_state_output outputs[KWM_STATE_OUTPUTS];
+};
+
+struct kwm_server;
+struct kwm_timer;
+
+/* This struct holds the state page and when it needs to be written again. Changes are written
+   with the next frame of an output, or with a timer when nothing is drawn. Frame statistics
+   alone are written with the timer, at most once per refresh interval across all outputs */
+struct kwm_state {
+	struct kwm_server *server;
+	char path[PATH_MAX];
+	int fd;
+	struct kwm_state_page *page;
+	struct kwm_state_page shadow;
+
+	bool dirty;
+	bool stats_pending;
+	struct kwm_timer *timer;
+};
+
+bool state_init(struct kwm_state *state, struct kwm_server *server);
+void state_finish(struct kwm_state *state);
+void state_mark_dirty(struct kwm_state *state);
+void state_frame(struct kwm_state *state);
+void state_publish(struct kwm_state *state);
+
+#endif
@@ -0,0 +1,181 @@
+#!/bin/sh
+# Tests output hotplug on the headless backend. kwm runs on the virtual clock with three
+# outputs and a client window on one of them. Unplugging outputs must move the window to
+# another one, or park it while there is none until an output is plugged in again. Each
+# hotplug must move the views once, and the output receiving the window must show it with
+# its next refresh while an output not involved does not repaint, as the frames counted on
+# the state page tell. With valgrind installed, kwm also runs under it and must not leak
+# memory from its own code.
+#
+# usage: tests/hotplug.sh [kwm]
+# The client is weston-simple-shm unless KWM_TEST_CLIENT names another one. tests/state,
+# built by make check, reads the state page.
+set -eu
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+kwm=$(cd "$(dirname "${1:-$top/kwm}")" && pwd)/$(basename "${1:-$top/kwm}")
+client_cmd=${KWM_TEST_CLIENT:-weston-simple-shm}
+state_reader=$top/tests/state
+[ -x "$state_reader" ] || { echo "hotplug: FAIL, build $state_reader first"; exit 1; }
+if ! command -v "$client_cmd" >/dev/null 2>&1; then
+	echo "hotplug: SKIP, $client_cmd is not installed"
+	exit 0
+fi
+
+dir=$(mktemp -d)
+log=$dir/kwm.log
+kwm_pid=
+client_pid=
+
+cleanup() {
+	[ -n "$client_pid" ] && kill "$client_pid" 2>/dev/null || true
+	[ -n "$kwm_pid" ] && kill "$kwm_pid" 2>/dev/null || true
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+
+fail() {
+	echo "hotplug: FAIL, $1"
+	tail -n 40 "$log"
+	exit 1
+}
+
+# Sends a line to the driver of the virtual clock and waits for kwm to answer it
+send() {
+	echo "$1" >&3
+	read -r now <&4 || fail "kwm went away on '$1'"
+}
+
+# Prints the views kwm lists on SIGUSR1, as "view APP_ID (pid PID) on OUTPUT: ..."
+views() {
+	dumps=$(grep -c 'Resource usage of' "$log" || true)
+	kill -USR1 "$kwm_pid"
+	i=0
+	while [ "$(grep -c 'Resource usage of' "$log" || true)" -le "$dumps" ]; do
+		i=$((i + 1))
+		[ "$i" -le 100 ] || fail "kwm did not list its views"
+		send 0
+		sleep 0.1
+	done
+	awk '/Resource usage of/ { dump = "" } { dump = dump $0 "\n" } END { printf "%s", dump }' \
+		"$log" | grep '  view '
+}
+
+# Prints the output the window is shown on, if any
+window_output() {
+	views | sed -n "s/.*(pid $client_pid) on \([^:]*\):.*/\1/p"
+}
+
+# Prints the frames an output showed as published on the state page, 0 when it is not
+# listed yet. A page read earlier can be passed in place of the current one
+frames() {
+	printf '%s\n' "${2:-$("$state_reader" "$state")}" |
+		awk -v name="$1" '$1 == name { n = $2 } END { print n + 0 }'
+}
+
+# Prints how many times kwm moved views between outputs
+relayouts() {
+	grep -c 'Moving [0-9]* views to' "$log" || true
+}
+
+# Runs a driver command which must move the views exactly once
+expect_relayout() {
+	before=$(relayouts)
+	send "$1"
+	[ "$(relayouts)" -eq $((before + 1)) ] || fail "'$1' did not move the views exactly once"
+}
+
+# Advances the virtual clock a millisecond at a time through one refresh period, within
+# which the output must show exactly one frame
+expect_frame() {
+	before=$(frames "$1")
+	i=0
+	while [ "$(frames "$1")" -eq "$before" ]; do
+		i=$((i + 1))
+		[ "$i" -le 17 ] || fail "$1 showed no frame within a refresh"
+		send 1
+	done
+	[ "$(frames "$1")" -eq $((before + 1)) ] || fail "$1 showed more than one frame"
+}
+
+# Advances the virtual clock by three refresh periods, after which the output must not have
+# repainted since the state page given was read. Frame statistics are published within a
+# refresh, so the count is read afterwards
+expect_idle() {
+	send 50
+	[ "$(frames "$1")" -eq "$(frames "$1" "$2")" ] ||
+		fail "$1 repainted although nothing changed on it"
+}
+
+mkfifo "$dir/in" "$dir/out"
+run=
+if command -v valgrind >/dev/null 2>&1; then
+	run="valgrind --leak-check=full --log-file=$dir/valgrind.log"
+fi
+XDG_RUNTIME_DIR=$dir WLR_HEADLESS_OUTPUTS=3 $run "$kwm" -t <"$dir/in" >"$dir/out" 2>"$log" &
+kwm_pid=$!
+exec 3>"$dir/in" 4<"$dir/out"
+
+send 0
+display=$(sed -n 's/.*Running compositor on WAYLAND_DISPLAY=//p' "$log")
+[ -n "$display" ] || fail "kwm did not start"
+state=$(sed -n 's/.*Publishing the state in //p' "$log")
+[ -n "$state" ] || fail "kwm does not publish its state"
+XDG_RUNTIME_DIR=$dir WAYLAND_DISPLAY=$display "$client_cmd" >"$dir/client.log" 2>&1 &
+client_pid=$!
+i=0
+until first=$(window_output) && [ -n "$first" ]; do
+	i=$((i + 1))
+	[ "$i" -le 60 ] || fail "the window was not mapped"
+	send 16
+done
+
+# Only the output of the window repaints once the outputs showed their first frames
+send 100
+page=$("$state_reader" "$state")
+
+# The window moves to one of the two other outputs, the third one is not involved
+expect_relayout "unplug $first"
+second=$(window_output)
+[ -n "$second" ] && [ "$second" != "$first" ] || fail "the window did not move off $first"
+for name in HEADLESS-1 HEADLESS-2 HEADLESS-3; do
+	[ "$name" = "$first" ] || [ "$name" = "$second" ] || other=$name
+done
+expect_frame "$second"
+expect_idle "$other" "$page"
+
+# An output without views goes away without moving the window
+expect_relayout "unplug $other"
+[ "$(window_output)" = "$second" ] || fail "the window left $second"
+
+# Without an output to go to, the window is parked
+expect_relayout "unplug $second"
+[ -z "$(window_output)" ] || fail "the window is still shown without an output"
+
+# A new output shows the parked window with its first frame
+expect_relayout "plug"
+[ "$(window_output)" = HEADLESS-4 ] || fail "the window did not move to HEADLESS-4"
+expect_frame HEADLESS-4
+
+kill "$client_pid"
+wait "$client_pid" 2>/dev/null || true
+client_pid=
+send 16
+exec 3>&- 4<&-
+wait "$kwm_pid" || fail "kwm exited with $?"
+kwm_pid=
+
+# Leaks are only counted against kwm when one of its functions allocated them
+if [ -n "$run" ]; then
+	sources=$(cd "$top" && ls *.c | tr '\n' '|' | sed 's/|$//')
+	leaks=$(awk -v bin="(in $kwm)" -v src="[(]($sources):" '
+		/are definitely lost/ { record = $0 "\n"; lost = 1; ours = 0; next }
+		lost && /^==[0-9]+== *$/ { if (ours) printf "%s", record; lost = 0; next }
+		lost { record = record $0 "\n"; if (index($0, bin) || $0 ~ src) ours = 1 }
+	' "$dir/valgrind.log")
+	if [ -n "$leaks" ]; then
+		echo "$leaks"
+		fail "kwm leaked memory"
+	fi
+fi
+echo "hotplug: PASS"
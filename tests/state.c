@@ -0,0 +1,50 @@
+/* Prints the outputs on the state page of kwm, one per line as "NAME FRAMES", for the tests.
+   The page is read the way state.h describes.
+
+   usage: tests/state PATH */
+#include "state.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: state PATH\n");
+		return EXIT_FAILURE;
+	}
+	int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	struct kwm_state_page *page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	struct kwm_state_page copy;
+	uint32_t seq;
+	do {
+		seq = atomic_load_explicit(&page->seq, memory_order_acquire);
+		memcpy(&copy, page, sizeof(copy));
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != atomic_load_explicit(&page->seq, memory_order_relaxed));
+	munmap(page, sizeof(*page));
+
+	if (copy.magic != KWM_STATE_MAGIC || copy.version != KWM_STATE_VERSION ||
+		copy.num_outputs > KWM_STATE_OUTPUTS) {
+		fprintf(stderr, "%s is not a state page of this kwm\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	for (uint32_t i = 0; i < copy.num_outputs; i++) {
+		struct kwm_state_output *output = &copy.outputs[i];
+		printf("%.*s %llu\n", (int)sizeof(output->name), output->name,
+			   (unsigned long long)output->frames);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#include "watchdog.h"
+#include "server.h"
+#include "kwm.h"
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+/* Signal the watchdog sends to the main thread to take its backtrace */
+#define WATCHDOG_SIGNAL SIGUSR2
+/* Milliseconds the watchdog waits for the main thread to take its backtrace */
+#define WATCHDOG_TRACE_TIMEOUT 100
+
+/* The signal handler has no user data */
+static struct kwm_watchdog *active_watchdog;
+
+static long timespec_diff_ms(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void sleep_ms(long ms) {
+	struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+	}
+}
+
+/* This function runs on the main thread when the watchdog asks for a backtrace */
+static void handle_watchdog_signal(int signal_number) {
+	struct kwm_watchdog *watchdog = active_watchdog;
+	if (watchdog != NULL) {
+		atomic_store(&watchdog->trace_len, backtrace(watchdog->trace, WATCHDOG_TRACE_DEPTH));
+	}
+}
+
+/* This function is called by libwayland for every message. It only remembers the last
+   request, which names the client kwm was busy with when a stall is reported */
+static void handle_protocol_message(void *data, enum wl_protocol_logger_type type,
+									const struct wl_protocol_logger_message *message) {
+	if (type != WL_PROTOCOL_LOGGER_REQUEST) {
+		return;
+	}
+	struct kwm_watchdog *watchdog = data;
+	pid_t pid = 0;
+	wl_client_get_credentials(wl_resource_get_client(message->resource), &pid, NULL, NULL);
+	atomic_store(&watchdog->interface, wl_resource_get_class(message->resource));
+	atomic_store(&watchdog->request, message->message->name);
+	atomic_store(&watchdog->client_pid, pid);
+}
+
+/* The log is never opened through a symbolic link, which another user could have planted */
+static int watchdog_open_log(struct kwm_watchdog *watchdog) {
+	return open(watchdog->log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | O_NOFOLLOW,
+				0600);
+}
+
+/* Relative paths are in the runtime directory, which only the user can write to */
+static bool watchdog_log_path(struct kwm_watchdog *watchdog) {
+	if (watchdog_log[0] == '/') {
+		snprintf(watchdog->log_path, sizeof(watchdog->log_path), "%s", watchdog_log);
+		return true;
+	}
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL) {
+		return false;
+	}
+	snprintf(watchdog->log_path, sizeof(watchdog->log_path), "%s/%s", dir, watchdog_log);
+	return true;
+}
+
+/* Keeps the log bounded. Once it grew over watchdog_log_size it replaces the previous one */
+static void watchdog_rotate_log(struct kwm_watchdog *watchdog) {
+	struct stat st;
+	if (fstat(watchdog->log_fd, &st) < 0 || st.st_size < watchdog_log_size * 1024L) {
+		return;
+	}
+	char old[PATH_MAX];
+	snprintf(old, sizeof(old), "%s.old", watchdog->log_path);
+	rename(watchdog->log_path, old);
+	int fd = watchdog_open_log(watchdog);
+	if (fd >= 0) {
+		close(watchdog->log_fd);
+		watchdog->log_fd = fd;
+	}
+}
+
+/* Writes a stall report: the phase of the main loop, the last client request, and the
+   backtrace of the main thread, which names the listener that is running */
+static void watchdog_report(struct kwm_watchdog *watchdog, const char *phase, long stalled) {
+	watchdog_rotate_log(watchdog);
+	int fd = watchdog->log_fd;
+
+	char date[32];
+	time_t now = time(NULL);
+	struct tm tm;
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm));
+	dprintf(fd, "%s: main loop stalled for %ld ms in %s\n", date, stalled, phase);
+
+	const char *interface = atomic_load(&watchdog->interface);
+	if (interface != NULL) {
+		dprintf(fd, "  last request %s.%s from pid %d\n", interface,
+				atomic_load(&watchdog->request), atomic_load(&watchdog->client_pid));
+	}
+
+	atomic_store(&watchdog->trace_len, -1);
+	pthread_kill(watchdog->main_thread, WATCHDOG_SIGNAL);
+	for (int i = 0; i < WATCHDOG_TRACE_TIMEOUT && atomic_load(&watchdog->trace_len) < 0; i++) {
+		sleep_ms(1);
+	}
+	int trace_len = atomic_load(&watchdog->trace_len);
+	if (trace_len > 0) {
+		backtrace_symbols_fd(watchdog->trace, trace_len, fd);
+	} else {
+		dprintf(fd, "  no backtrace, the main thread did not respond\n");
+	}
+
+	wlr_log(WLR_ERROR, "Main loop stalled for %ld ms in %s, see %s", stalled, phase,
+			watchdog->log_path);
+}
+
+/* The watchdog thread samples the main loop a few times per threshold. A stall is an
+   iteration that stays busy for longer than the threshold, it is reported once and its
+   total duration is logged when the iteration completes */
+static void *watchdog_run(void *data) {
+	struct kwm_watchdog *watchdog = data;
+	unsigned int iteration = atomic_load(&watchdog->iteration);
+	struct timespec since, now;
+	clock_gettime(CLOCK_MONOTONIC, &since);
+	bool reported = false;
+
+	while (atomic_load(&watchdog->running)) {
+		sleep_ms(watchdog_threshold / 4 > 0 ? watchdog_threshold / 4 : 1);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		unsigned int current = atomic_load(&watchdog->iteration);
+		const char *phase = atomic_load(&watchdog->phase);
+		if (current != iteration || phase == NULL) {
+			if (reported) {
+				dprintf(watchdog->log_fd, "  stall ended after about %ld ms\n",
+						timespec_diff_ms(&since, &now));
+			}
+			iteration = current;
+			since = now;
+			reported = false;
+			continue;
+		}
+		long stalled = timespec_diff_ms(&since, &now);
+		if (!reported && stalled >= watchdog_threshold) {
+			watchdog_report(watchdog, phase, stalled);
+			reported = true;
+		}
+	}
+	return NULL;
+}
+
+/* This function starts the watchdog thread, unless watchdog_threshold disables it */
+void watchdog_start(struct kwm_watchdog *watchdog, struct wl_display *display) {
+	watchdog->log_fd = -1;
+	if (watchdog_threshold <= 0) {
+		return;
+	}
+	if (!watchdog_log_path(watchdog)) {
+		wlr_log(WLR_ERROR, "No XDG_RUNTIME_DIR for %s, the watchdog is disabled", watchdog_log);
+		return;
+	}
+	watchdog->log_fd = watchdog_open_log(watchdog);
+	if (watchdog->log_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s, the watchdog is disabled",
+					  watchdog->log_path);
+		return;
+	}
+
+	/* backtrace loads libgcc on first use, which must not happen in the signal handler */
+	backtrace(watchdog->trace, WATCHDOG_TRACE_DEPTH);
+	active_watchdog = watchdog;
+	struct sigaction sa = {.sa_handler = handle_watchdog_signal, .sa_flags = SA_RESTART};
+	sigemptyset(&sa.sa_mask);
+	sigaction(WATCHDOG_SIGNAL, &sa, NULL);
+
+	watchdog->main_thread = pthread_self();
+	watchdog->logger = wl_display_add_protocol_logger(display, handle_protocol_message, watchdog);
+	atomic_store(&watchdog->running, true);
+
+	/* Signals are handled by the main thread, through the event loop or the handler above */
+	sigset_t all, previous;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &previous);
+	int ret = pthread_create(&watchdog->thread, NULL, watchdog_run, watchdog);
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	if (ret != 0) {
+		wlr_log(WLR_ERROR, "Failed to start the watchdog thread: %s", strerror(ret));
+		watchdog_stop(watchdog);
+		return;
+	}
+	watchdog->started = true;
+}
+
+/* This function stops the watchdog thread and closes its log */
+void watchdog_stop(struct kwm_watchdog *watchdog) {
+	atomic_store(&watchdog->running, false);
+	if (watchdog->started) {
+		pthread_join(watchdog->thread, NULL);
+		watchdog->started = false;
+	}
+	if (watchdog->logger != NULL) {
+		wl_protocol_logger_destroy(watchdog->logger);
+		watchdog->logger = NULL;
+	}
+	if (active_watchdog == watchdog) {
+		signal(WATCHDOG_SIGNAL, SIG_DFL);
+		active_watchdog = NULL;
+	}
+	if (watchdog->log_fd >= 0) {
+		close(watchdog->log_fd);
+		watchdog->log_fd = -1;
+	}
+}
+
+/* This function is called by the main loop when it starts an iteration */
+void watchdog_wake(struct kwm_watchdog *watchdog) {
+	atomic_store(&watchdog->interface, NULL);
+	atomic_fetch_add(&watchdog->iteration, 1);
+}
+
+/* This function is called by the main loop when it moves on to another phase, NULL when it
+   is about to wait for events */
+void watchdog_phase(struct kwm_watchdog *watchdog, const char *phase) {
+	atomic_store(&watchdog->phase, phase);
+}
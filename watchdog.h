@@ -0,0 +1,41 @@
+#ifndef KWM_WATCHDOG_H
+#define KWM_WATCHDOG_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <wayland-server.h>
+
+#define WATCHDOG_TRACE_DEPTH 64
+
+/* This struct holds the state of the stall watchdog. The main thread publishes what it is
+   doing, and the watchdog thread writes a report when it keeps doing it for too long */
+struct kwm_watchdog {
+	bool started;
+	pthread_t thread;
+	pthread_t main_thread;
+	atomic_bool running;
+	char log_path[PATH_MAX];
+	int log_fd;
+	struct wl_protocol_logger *logger;
+
+	/* Written by the main thread. The phase is NULL while the loop waits for events */
+	atomic_uint iteration;
+	_Atomic(const char *) phase;
+	/* Last client request dispatched in this iteration */
+	_Atomic(const char *) interface;
+	_Atomic(const char *) request;
+	atomic_int client_pid;
+
+	/* Backtrace of the main thread, taken by its signal handler on request */
+	void *trace[WATCHDOG_TRACE_DEPTH];
+	atomic_int trace_len;
+};
+
+void watchdog_start(struct kwm_watchdog *watchdog, struct wl_display *display);
+void watchdog_stop(struct kwm_watchdog *watchdog);
+void watchdog_wake(struct kwm_watchdog *watchdog);
+void watchdog_phase(struct kwm_watchdog *watchdog, const char *phase);
+
+#endif
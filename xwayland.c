@@ -0,0 +1,250 @@
+#include "server.h"
+#include "kwm.h"
+#include "xwayland.h"
+#include <stdlib.h>
+#include <wlr/util/log.h>
+
+/* Creates the wlr_xwayland in lazy mode. This only binds the X display socket, wlroots
+   spawns the Xwayland process when a client connects to it */
+static bool xwayland_create_lazy(struct kwm_xwayland *xwayland) {
+	struct kwm_server *server = xwayland->server;
+	xwayland->wlr_xwayland = wlr_xwayland_create(server->display, server->compositor, true);
+	if (xwayland->wlr_xwayland == NULL) {
+		return false;
+	}
+	xwayland->started = false;
+
+	xwayland->ready.notify = handle_xwayland_ready;
+	wl_signal_add(&xwayland->wlr_xwayland->events.ready, &xwayland->ready);
+	xwayland->new_surface.notify = handle_new_xwayland_surface;
+	wl_signal_add(&xwayland->wlr_xwayland->events.new_surface, &xwayland->new_surface);
+
+	/* Processes spawned from now on connect to this display */
+	setenv("DISPLAY", xwayland->wlr_xwayland->display_name, true);
+	wlr_log(WLR_INFO, "Reserved X display %s", xwayland->wlr_xwayland->display_name);
+	return true;
+}
+
+/* Stops the Xwayland process, if it is running, and releases the X display socket */
+static void xwayland_destroy(struct kwm_xwayland *xwayland) {
+	if (xwayland->wlr_xwayland == NULL) {
+		return;
+	}
+	wl_list_remove(&xwayland->ready.link);
+	wl_list_remove(&xwayland->new_surface.link);
+	wlr_xwayland_destroy(xwayland->wlr_xwayland);
+	xwayland->wlr_xwayland = NULL;
+	xwayland->started = false;
+}
+
+/* This function is called when there were no X windows for xwayland_idle_timeout seconds.
+   The Xwayland process is stopped and the display is reserved again, so that the next X
+   client starts a fresh server. X clients without any window are disconnected. */
+static int handle_xwayland_idle(void *data) {
+	struct kwm_xwayland *xwayland = data;
+	if (!xwayland->started || xwayland->surfaces > 0) {
+		return 0;
+	}
+
+	wlr_log(WLR_INFO, "No X windows for %d seconds, stopping Xwayland", xwayland_idle_timeout);
+	xwayland_destroy(xwayland);
+	if (!xwayland_create_lazy(xwayland)) {
+		wlr_log(WLR_ERROR, "Failed to reserve the X display again");
+	}
+	return 0;
+}
+
+/* Arms the idle timer while there are no X windows, disarms it otherwise */
+static void xwayland_update_idle(struct kwm_xwayland *xwayland) {
+	if (xwayland->idle_timer == NULL || xwayland_idle_timeout <= 0) {
+		return;
+	}
+	int timeout = 0;
+	if (xwayland->started && xwayland->surfaces == 0) {
+		timeout = xwayland_idle_timeout * 1000;
+	}
+	clock_timer_update(xwayland->idle_timer, timeout);
+}
+
+/* This function reserves the X display at startup. Nothing is spawned yet */
+bool xwayland_init(struct kwm_xwayland *xwayland, struct kwm_server *server) {
+	xwayland->server = server;
+	xwayland->idle_timer = clock_add_timer(&server->clock, handle_xwayland_idle, xwayland);
+	return xwayland_create_lazy(xwayland);
+}
+
+/* This function stops Xwayland when kwm exits */
+void xwayland_finish(struct kwm_xwayland *xwayland) {
+	xwayland_destroy(xwayland);
+	if (xwayland->idle_timer != NULL) {
+		clock_timer_remove(xwayland->idle_timer);
+		xwayland->idle_timer = NULL;
+	}
+}
+
+/* This function is called once the Xwayland process runs and its window manager is
+   connected, which happens after the first X client connected to the display */
+void handle_xwayland_ready(struct wl_listener *listener, void *data) {
+	struct kwm_xwayland *xwayland = wl_container_of(listener, xwayland, ready);
+	struct kwm_server *server = xwayland->server;
+	wlr_log(WLR_INFO, "Xwayland started on %s", xwayland->wlr_xwayland->display_name);
+	xwayland->started = true;
+
+	wlr_xwayland_set_seat(xwayland->wlr_xwayland, server->seat);
+
+	/* X clients expect the root window to have a cursor */
+	struct wlr_xcursor *xcursor =
+		wlr_xcursor_manager_get_xcursor(server->cursor_mgr, "left_ptr", 1);
+	if (xcursor != NULL) {
+		struct wlr_xcursor_image *image = xcursor->images[0];
+		wlr_xwayland_set_cursor(xwayland->wlr_xwayland, image->buffer, image->width * 4,
+								image->width, image->height, image->hotspot_x,
+								image->hotspot_y);
+	}
+
+	/* Clients like xrdb connect without ever creating a window */
+	xwayland_update_idle(xwayland);
+}
+
+/* This function is called when the scene node of the surface goes away, either because the
+   view was unmapped or because the wlr_surface was destroyed first */
+static void handle_xwayland_surface_node_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, surface_destroy);
+	wl_list_remove(&view->commit.link);
+	wl_list_remove(&view->surface_destroy.link);
+	view->surface_node = NULL;
+}
+
+/* This function is called whenever the surface of an X window commits new state */
+void handle_xwayland_surface_commit(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, commit);
+	struct wlr_xwayland_surface *xsurface = view->xwayland_surface;
+
+	if (view->resizing) {
+		/* X windows have no configure serials, any commit answers the last configure */
+		view_resize_commit(view, true);
+	} else if (xsurface->override_redirect && (xsurface->x != view->x || xsurface->y != view->y)) {
+		/* Override redirect windows place themselves */
+		view->x = xsurface->x, view->y = xsurface->y;
+		scene_node_set_position(view->scene_tree, view->x, view->y);
+	}
+	view_update_borders(view);
+}
+
+/* This function is called when an X window is mapped. Unlike xdg surfaces, the wlr_surface
+   of an X window can change between maps, so the scene node only lives while mapped */
+void handle_xwayland_surface_map(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, map);
+	struct wlr_xwayland_surface *xsurface = view->xwayland_surface;
+
+	view->surface_node = scene_surface_create(view->scene_tree, xsurface->surface);
+	if (view->surface_node == NULL) {
+		return;
+	}
+	view->surface_destroy.notify = handle_xwayland_surface_node_destroy;
+	wl_signal_add(&view->surface_node->node.events.destroy, &view->surface_destroy);
+	view->commit.notify = handle_xwayland_surface_commit;
+	wl_signal_add(&xsurface->surface->events.commit, &view->commit);
+
+	view->x = xsurface->x, view->y = xsurface->y;
+	scene_node_set_position(view->scene_tree, view->x, view->y);
+	view_map(view);
+}
+
+/* This function is called when an X window is unmapped */
+void handle_xwayland_surface_unmap(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, unmap);
+	view_unmap(view);
+	if (view->surface_node != NULL) {
+		scene_node_destroy(&view->surface_node->node);
+	}
+}
+
+/* This function is called when an X window is destroyed */
+void handle_xwayland_surface_destroy(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, destroy);
+	struct kwm_xwayland *xwayland = &view->server->xwayland;
+
+	wl_list_remove(&view->map.link);
+	wl_list_remove(&view->unmap.link);
+	wl_list_remove(&view->destroy.link);
+	wl_list_remove(&view->request_configure.link);
+	wl_list_remove(&view->request_move.link);
+	wl_list_remove(&view->request_resize.link);
+	wl_list_remove(&view->set_title.link);
+	wl_list_remove(&view->set_app_id.link);
+	view_destroy(view);
+
+	xwayland->surfaces--;
+	xwayland_update_idle(xwayland);
+}
+
+/* This function is called when an X window asks for a position and size. kwm does not
+   tile, so the request is granted as is */
+void handle_xwayland_surface_request_configure(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, request_configure);
+	struct wlr_xwayland_surface_configure_event *event = data;
+
+	wlr_xwayland_surface_configure(event->surface, event->x, event->y, event->width,
+								   event->height);
+	if (view->server->grabbed_view != view) {
+		view->x = event->x, view->y = event->y;
+		scene_node_set_position(view->scene_tree, view->x, view->y);
+	}
+}
+
+/* This function is called when an X window would like to begin an interactive move */
+void handle_xwayland_surface_request_move(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, request_move);
+	begin_interactive(view, KWM_CURSOR_MOVE, 0);
+}
+
+/* This function is called when an X window would like to be resized interactively */
+void handle_xwayland_surface_request_resize(struct wl_listener *listener, void *data) {
+	struct kwm_view *view = wl_container_of(listener, view, request_resize);
+	struct wlr_xwayland_resize_event *event = data;
+	begin_interactive(view, KWM_CURSOR_RESIZE, event->edges);
+}
+
+/* This function is called whenever an X client creates a window. X windows become views on
+   the shown tags, just like xdg toplevels */
+void handle_new_xwayland_surface(struct wl_listener *listener, void *data) {
+	struct kwm_xwayland *xwayland = wl_container_of(listener, xwayland, new_surface);
+	struct wlr_xwayland_surface *xsurface = data;
+
+	wlr_log(WLR_DEBUG, "New xwayland surface title='%s' class='%s'", xsurface->title,
+			xsurface->class);
+
+	struct kwm_view *view = view_create(xwayland->server, KWM_VIEW_XWAYLAND);
+	if (view == NULL) {
+		return;
+	}
+	view->xwayland_surface = xsurface;
+	xwayland->surfaces++;
+	xwayland_update_idle(xwayland);
+
+	/* Listen to the various events it can emit */
+	view->map.notify = handle_xwayland_surface_map;
+	wl_signal_add(&xsurface->events.map, &view->map);
+
+	view->unmap.notify = handle_xwayland_surface_unmap;
+	wl_signal_add(&xsurface->events.unmap, &view->unmap);
+
+	view->destroy.notify = handle_xwayland_surface_destroy;
+	wl_signal_add(&xsurface->events.destroy, &view->destroy);
+
+	view->request_configure.notify = handle_xwayland_surface_request_configure;
+	wl_signal_add(&xsurface->events.request_configure, &view->request_configure);
+
+	view->request_move.notify = handle_xwayland_surface_request_move;
+	wl_signal_add(&xsurface->events.request_move, &view->request_move);
+
+	view->request_resize.notify = handle_xwayland_surface_request_resize;
+	wl_signal_add(&xsurface->events.request_resize, &view->request_resize);
+
+	view->set_title.notify = handle_view_set_title;
+	wl_signal_add(&xsurface->events.set_title, &view->set_title);
+
+	view->set_app_id.notify = handle_view_set_app_id;
+	wl_signal_add(&xsurface->events.set_class, &view->set_app_id);
+}
@@ -0,0 +1,40 @@
+#ifndef KWM_XWAYLAND_H
+#define KWM_XWAYLAND_H
+
+#include <wayland-server.h>
+#include <wlr/xwayland.h>
+
+struct kwm_server;
+
+/* This struct holds the state of the Xwayland server. The X display socket is reserved as
+   soon as kwm starts, the Xwayland process itself is only spawned by wlroots once the first
+   X client connects to that socket */
+struct kwm_xwayland {
+	struct kwm_server *server;
+	struct wlr_xwayland *wlr_xwayland;
+
+	/* Set once the Xwayland process has been spawned and its window manager is ready */
+	bool started;
+	/* Number of X surfaces alive, Xwayland is stopped once this stays at zero for
+	   xwayland_idle_timeout seconds */
+	int surfaces;
+	struct kwm_timer *idle_timer;
+
+	struct wl_listener ready;
+	struct wl_listener new_surface;
+};
+
+bool xwayland_init(struct kwm_xwayland *xwayland, struct kwm_server *server);
+void xwayland_finish(struct kwm_xwayland *xwayland);
+
+void handle_xwayland_ready(struct wl_listener *listener, void *data);
+void handle_new_xwayland_surface(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_commit(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_map(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_unmap(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_destroy(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_request_configure(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_request_move(struct wl_listener *listener, void *data);
+void handle_xwayland_surface_request_resize(struct wl_listener *listener, void *data);
+
+#endif